@@ -6,18 +6,23 @@
 #include <catch2/catch_test_macros.hpp>
 #include <range/v3/all.hpp>
 
+#include <atomic>
 #include <charconv>
+#include <exception>
 #include <fstream>
 #include <functional>
 #include <iostream>
 #include <queue>
 #include <set>
+#include <span>
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
+#include <vector>
 
 namespace rn = ranges;
 namespace rv = ranges::views;
@@ -38,3 +43,114 @@ using namespace std::string_view_literals;
 
 template <typename T>
 T fromString(std::string_view v);
+
+// Row major 2D array in a single allocation, rows are stride elements apart
+template <typename T>
+struct Grid
+{
+  std::size_t width{};
+  std::size_t height{};
+  std::size_t stride{};
+  std::vector<T> data;
+
+  Grid() = default;
+
+  Grid(std::size_t width, std::size_t height, T value = {}) :
+      width(width), height(height), stride(width), data(width * height, value)
+  {
+  }
+
+  Grid(std::size_t width, std::size_t height, std::vector<T> data) :
+      width(width), height(height), stride(width), data(std::move(data))
+  {
+    if (this->data.size() != width * height)
+      throw std::runtime_error("Grid size mismatch");
+  }
+
+  bool operator==(const Grid&) const = default;
+
+  T& operator()(std::size_t x, std::size_t y)
+  {
+    return data[y * stride + x];
+  }
+
+  const T& operator()(std::size_t x, std::size_t y) const
+  {
+    return data[y * stride + x];
+  }
+
+  std::span<T> row(std::size_t y)
+  {
+    return {data.data() + y * stride, width};
+  }
+
+  std::span<const T> row(std::size_t y) const
+  {
+    return {data.data() + y * stride, width};
+  }
+
+  auto column(std::size_t x)
+  {
+    return rv::iota(std::size_t{0}, height) | rv::transform([this, x](std::size_t y) -> T& { return (*this)(x, y); });
+  }
+
+  auto column(std::size_t x) const
+  {
+    return rv::iota(std::size_t{0}, height) |
+           rv::transform([this, x](std::size_t y) -> const T& { return (*this)(x, y); });
+  }
+
+  // Copy with rows and columns swapped, lets column walks run over contiguous memory
+  Grid transposed() const
+  {
+    Grid result(height, width);
+    for (std::size_t y = 0; y < height; y++) {
+      for (std::size_t x = 0; x < width; x++)
+        result(y, x) = (*this)(x, y);
+    }
+    return result;
+  }
+};
+
+// Splits [0, count) into one contiguous range per thread and calls fn(begin, end) for each of them. The calling thread
+// takes the first range. Once all threads are done, the first exception thrown by fn is rethrown on the calling thread.
+template <typename Fn>
+void parallelFor(std::size_t count, std::size_t threadCount, Fn&& fn)
+{
+  threadCount = std::clamp<std::size_t>(threadCount, 1, std::max<std::size_t>(count, 1));
+  auto rangeBegin = [&](std::size_t t) { return count * t / threadCount; };
+
+  std::vector<std::exception_ptr> errors(threadCount);
+  auto runRange = [&](std::size_t t) {
+    try {
+      fn(rangeBegin(t), rangeBegin(t + 1));
+    } catch (...) {
+      errors[t] = std::current_exception();
+    }
+  };
+
+  {
+    std::vector<std::jthread> threads;
+    threads.reserve(threadCount - 1);
+    for (std::size_t t = 1; t < threadCount; t++)
+      threads.emplace_back(runRange, t);
+    runRange(0);
+  }
+
+  for (const auto& error : errors) {
+    if (error)
+      std::rethrow_exception(error);
+  }
+}
+
+// Calls fn(i) for every i in [0, count) on a number of threads. Threads take the next index once they are done with
+// one, which keeps all of them busy when items take very different times.
+template <typename Fn>
+void parallelForEach(std::size_t count, std::size_t threadCount, Fn&& fn)
+{
+  std::atomic<std::size_t> next{0};
+  parallelFor(std::min(count, threadCount), threadCount, [&](std::size_t, std::size_t) {
+    for (std::size_t i = next++; i < count; i = next++)
+      fn(i);
+  });
+}
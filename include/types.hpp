@@ -1,6 +1,10 @@
 #include <cstdint>
 
+using u8 = std::uint8_t;
 using i32 = std::int32_t;
 using i64 = std::int64_t;
 using u32 = std::uint32_t;
 using u64 = std::uint64_t;
+#ifdef __SIZEOF_INT128__
+using u128 = unsigned __int128;
+#endif
@@ -1,5 +1,7 @@
 #include <common.hpp>
 
+#include <random>
+
 #define RUN_TESTS
 
 struct Instruction
@@ -48,6 +50,12 @@ std::vector<Instruction> parseInstructions(std::istream&& input)
          ranges::to<std::vector<Instruction>>();
 }
 
+// Cycles every op takes, indexed by Instruction::Op
+constexpr std::array<u32, 2> opCycles{
+    2, // Addx
+    1, // Noop
+};
+
 struct CPU
 {
   i32 x{1};
@@ -59,16 +67,106 @@ struct CPU
   {
     switch (instruction.op) {
     case Instruction::Op::Noop:
-      cycle++;
       break;
     case Instruction::Op::Addx:
       x += instruction.arg;
-      cycle += 2;
       break;
     }
+    cycle += opCycles[static_cast<std::size_t>(instruction.op)];
   }
 };
 
+// Program decoded once for run(), new ops get an entry here, in cycles and a handler in run()
+struct DecodedProgram
+{
+  enum class Op : u8
+  {
+    Addx,
+    Noop,
+    // Appended after the last instruction
+    Halt,
+  };
+
+  // Cycles every op takes, indexed by Op
+  static constexpr std::array<u32, 3> cycles{
+      opCycles[static_cast<std::size_t>(Instruction::Op::Addx)], // Addx
+      opCycles[static_cast<std::size_t>(Instruction::Op::Noop)], // Noop
+      0,                                                         // Halt
+  };
+  static_assert(cycles.size() == static_cast<std::size_t>(Op::Halt) + 1);
+
+  struct Entry
+  {
+    Op op;
+    i32 arg;
+  };
+
+  std::vector<Entry> entries;
+};
+
+DecodedProgram decode(const std::vector<Instruction>& instructions)
+{
+  using Op = DecodedProgram::Op;
+  DecodedProgram program;
+  program.entries.reserve(instructions.size() + 1);
+  for (const auto& i : instructions) {
+    switch (i.op) {
+    case Instruction::Op::Addx:
+      program.entries.push_back({Op::Addx, i.arg});
+      break;
+    case Instruction::Op::Noop:
+      program.entries.push_back({Op::Noop, 0});
+      break;
+    }
+  }
+  program.entries.push_back({Op::Halt, 0});
+  return program;
+}
+
+// Same as calling CPU::execute for every instruction. With GCC and Clang every handler jumps directly to the handler of
+// the next instruction through a table of label addresses, which gives the branch predictor one indirect jump per
+// handler instead of a single shared one. Other compilers use a switch.
+void run(CPU& cpu, const DecodedProgram& program)
+{
+  using Op = DecodedProgram::Op;
+  const DecodedProgram::Entry* ip = program.entries.data();
+  i32 x = cpu.x;
+  u32 cycle = cpu.cycle;
+
+#ifdef __GNUC__
+  static void* const handlers[] = {&&addx, &&noop, &&halt};
+#define DISPATCH() goto* handlers[static_cast<std::size_t>(ip->op)]
+
+  DISPATCH();
+addx:
+  x += ip->arg;
+  cycle += DecodedProgram::cycles[static_cast<std::size_t>(Op::Addx)];
+  ip++;
+  DISPATCH();
+noop:
+  cycle += DecodedProgram::cycles[static_cast<std::size_t>(Op::Noop)];
+  ip++;
+  DISPATCH();
+halt:
+#undef DISPATCH
+#else
+  for (; ip->op != Op::Halt; ip++) {
+    switch (ip->op) {
+    case Op::Addx:
+      x += ip->arg;
+      break;
+    case Op::Noop:
+    case Op::Halt:
+      break;
+    }
+    cycle += DecodedProgram::cycles[static_cast<std::size_t>(ip->op)];
+  }
+#endif
+
+  cpu.x = x;
+  cpu.cycle = cycle;
+}
+
 struct RegisterProber
 {
   u32 firstProbe{20};
@@ -98,36 +196,76 @@ struct RegisterProber
   }
 };
 
+// Display of any size, every row is stored as packed 64 bit words. A whole span of cycles with the same sprite position
+// is drawn at once by OR-ing the visible part of the 3 pixel sprite into the rows.
 struct Crt
 {
-  std::array<bool, 240> display{};
-  u32 cycle{};
+  explicit Crt(u32 width = 40, u32 height = 6) :
+      width(width), height(height), wordsPerRow((width + 63) / 64), display(std::size_t{wordsPerRow} * height)
+  {
+  }
+
+  u32 width;
+  u32 height;
+  u32 wordsPerRow;
+  std::vector<u64> display;
+  u64 cycle{};
 
   i32 lastRegisterValue{1};
 
+  bool pixel(u32 col, u32 row) const
+  {
+    return (display[std::size_t{row} * wordsPerRow + col / 64] >> (col % 64)) & 1;
+  }
+
   void update(CPU cpu)
   {
-    while (cycle < cpu.cycle && cycle < display.size()) {
-      if (std::abs(static_cast<i32>(cycle % 40) - lastRegisterValue) <= 1) {
-        display[cycle] = true;
-      }
-      cycle++;
+    const u64 end = std::min<u64>(cpu.cycle, u64{width} * height);
+    while (cycle < end) {
+      auto row = static_cast<u32>(cycle / width);
+      auto spanBegin = static_cast<u32>(cycle % width);
+      auto spanEnd = static_cast<u32>(std::min<u64>(width, spanBegin + (end - cycle)));
+
+      // Part of the sprite that is inside both the screen and the span
+      i64 lo = std::max<i64>(spanBegin, i64{lastRegisterValue} - 1);
+      i64 hi = std::min<i64>(spanEnd, i64{lastRegisterValue} + 2);
+      if (lo < hi)
+        setPixels(row, static_cast<u32>(lo), static_cast<u32>(hi));
+
+      cycle += spanEnd - spanBegin;
     }
     lastRegisterValue = cpu.x;
   }
 
   std::string createImage() const
   {
+    constexpr std::string_view lit = "█";
     std::string result;
-    result.reserve(display.size() + 6);
-    for (std::size_t row = 0; row < 6; row++) {
-      for (std::size_t col = 0; col < 40; col++) {
-        result += display[row * 40 + col] ? "█" : ".";
+    result.reserve(std::size_t{width} * height * lit.size() + height);
+    for (u32 row = 0; row < height; row++) {
+      for (u32 col = 0; col < width; col++) {
+        if (pixel(col, row))
+          result += lit;
+        else
+          result += '.';
       }
       result += '\n';
     }
     return result;
   }
+
+private:
+  // Sets the pixels [lo, hi) of a row, one OR per touched word
+  void setPixels(u32 row, u32 lo, u32 hi)
+  {
+    u64* words = display.data() + std::size_t{row} * wordsPerRow;
+    for (u32 word = lo / 64; word * 64 < hi; word++) {
+      u32 first = std::max(lo, word * 64) - word * 64;
+      u32 last = std::min(hi, word * 64 + 64) - word * 64;
+      u64 mask = (last == 64 ? ~u64{} : (u64{1} << last) - 1) & ~((u64{1} << first) - 1);
+      words[word] |= mask;
+    }
+  }
 };
 
 u64 getSignalStrength(const RegisterProber& prober)
@@ -143,23 +281,111 @@ u64 getSignalStrength(const RegisterProber& prober)
   return first + rest;
 }
 
-void simulate(const std::vector<Instruction>& instructions, CPU& cpu, RegisterProber& prober, Crt& crt)
+template <typename T>
+concept CpuObserver = requires(T observer, CPU cpu) { observer.update(cpu); };
+
+// Runs the program and calls update(cpu) of every observer once at the start and after every instruction, in the order
+// they are passed. Dispatch is resolved at compile time, so the loop only contains the observers actually used.
+template <CpuObserver... Observers>
+void simulate(const std::vector<Instruction>& instructions, CPU& cpu, Observers&... observers)
 {
-  prober.update(cpu);
+  (observers.update(cpu), ...);
 
   for (const auto& i : instructions) {
     cpu.execute(i);
-    prober.update(cpu);
-    crt.update(cpu);
+    (observers.update(cpu), ...);
   }
 }
 
+// Value of the X register over the whole program, stored only at the cycles where it changes
+struct RegisterTimeline
+{
+  // changeCycles[i] is the first cycle (counting from 1) during which X has the value values[i]
+  std::vector<u64> changeCycles{1};
+  std::vector<i32> values{1};
+  u64 totalCycles{};
+
+  i32 valueDuring(u64 cycle) const
+  {
+    auto next = ranges::upper_bound(changeCycles, cycle);
+    if (next == changeCycles.begin())
+      throw std::runtime_error("Cycles start at 1");
+    return values[next - changeCycles.begin() - 1];
+  }
+
+  std::vector<i32> valuesDuring(const std::vector<u64>& cycles) const
+  {
+    return cycles | ranges::views::transform([this](u64 cycle) { return valueDuring(cycle); }) |
+           ranges::to<std::vector<i32>>();
+  }
+
+  // Sum of cycle * X during each of the given cycles
+  i64 signalStrength(const std::vector<u64>& cycles) const
+  {
+    return ranges::accumulate(cycles, i64{}, [this](i64 sum, u64 cycle) {
+      return sum + static_cast<i64>(cycle) * valueDuring(cycle);
+    });
+  }
+};
+
+RegisterTimeline compileTimeline(const std::vector<Instruction>& instructions)
+{
+  RegisterTimeline timeline;
+  CPU cpu;
+  u64 cycle{};
+  for (const auto& i : instructions) {
+    auto before = cpu;
+    cpu.execute(i);
+    cycle += cpu.cycle - before.cycle;
+    if (cpu.x != before.x) {
+      timeline.changeCycles.push_back(cycle + 1);
+      timeline.values.push_back(cpu.x);
+    }
+  }
+  timeline.totalCycles = cycle;
+  return timeline;
+}
+
 std::ostream& operator<<(std::ostream& os, const CPU& value)
 {
   os << value.x << ", " << value.cycle;
   return os;
 }
 
+struct ProgramResult
+{
+  u64 signalStrength{};
+  std::string image;
+
+  bool operator==(const ProgramResult&) const = default;
+};
+
+ProgramResult runProgram(const std::vector<Instruction>& instructions)
+{
+  CPU cpu{};
+  RegisterProber prober{};
+  Crt crt{};
+  simulate(instructions, cpu, prober, crt);
+  return {getSignalStrength(prober), crt.createImage()};
+}
+
+// Runs many programs, given either as source text or already parsed, spread over a number of threads. Every program
+// gets its own CPU, RegisterProber and Crt. Results are in the order of programs, a program that fails to parse throws
+// on the calling thread.
+template <typename Program>
+std::vector<ProgramResult> runPrograms(const std::vector<Program>& programs,
+                                       std::size_t threadCount = std::thread::hardware_concurrency())
+{
+  std::vector<ProgramResult> results(programs.size());
+  parallelForEach(programs.size(), threadCount, [&](std::size_t i) {
+    if constexpr (std::is_same_v<Program, std::string>)
+      results[i] = runProgram(parseInstructions(std::stringstream(programs[i])));
+    else
+      results[i] = runProgram(programs[i]);
+  });
+  return results;
+}
+
 #ifndef RUN_TESTS
 #include <fstream>
 
@@ -178,6 +404,18 @@ auto main() -> int
 }
 
 #else
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+std::vector<Instruction> randomProgram(std::size_t count, u32 seed = 1)
+{
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int> op(0, 1);
+  std::uniform_int_distribution<i32> arg(-20, 20);
+  std::vector<Instruction> program(count);
+  for (auto& instruction : program)
+    instruction = op(rng) ? Instruction{Instruction::Op::Addx, arg(rng)} : Instruction{Instruction::Op::Noop};
+  return program;
+}
 
 TEST_CASE("Parsing")
 {
@@ -234,6 +472,62 @@ TEST_CASE("Simulate")
     REQUIRE(getSignalStrength(prober) == 13140);
   }
 
+  SECTION("Threaded interpreter")
+  {
+    CPU threaded{};
+    run(threaded, decode(instructions));
+    REQUIRE(threaded == cpu);
+
+    auto program = randomProgram(10000);
+    CPU switched{};
+    for (const auto& i : program)
+      switched.execute(i);
+    threaded = {};
+    run(threaded, decode(program));
+    REQUIRE(threaded == switched);
+
+    run(threaded, decode({}));
+    REQUIRE(threaded == switched);
+  }
+
+  SECTION("Observers")
+  {
+    struct Trace
+    {
+      std::vector<CPU> states;
+
+      void update(CPU cpu)
+      {
+        states.push_back(cpu);
+      }
+    };
+
+    CPU traceCpu{};
+    Trace trace;
+    RegisterProber traceProber{};
+    simulate(instructions, traceCpu, trace, traceProber);
+    REQUIRE(trace.states.size() == instructions.size() + 1);
+    REQUIRE(trace.states.front() == CPU{});
+    REQUIRE(trace.states.back() == cpu);
+    REQUIRE(traceProber.probes == prober.probes);
+
+    CPU bareCpu{};
+    simulate(instructions, bareCpu);
+    REQUIRE(bareCpu == cpu);
+  }
+
+  SECTION("Timeline")
+  {
+    auto timeline = compileTimeline(instructions);
+    REQUIRE(timeline.totalCycles == cpu.cycle);
+    REQUIRE(timeline.valuesDuring({20, 60, 100, 140, 180, 220}) == prober.probes);
+    REQUIRE(timeline.signalStrength({20, 60, 100, 140, 180, 220}) == 13140);
+    REQUIRE_THROWS(timeline.valueDuring(0));
+
+    auto small = compileTimeline(parseInstructions(std::stringstream("noop\naddx 3\naddx -5\n")));
+    REQUIRE(small.valuesDuring({1, 2, 3, 4, 5, 6, 7}) == std::vector{1, 1, 1, 4, 4, -1, -1});
+  }
+
   SECTION("Crt")
   {
     std::string ref = 1 + R"(
@@ -247,5 +541,106 @@ TEST_CASE("Simulate")
     std::string img = crt.createImage();
     REQUIRE(img == ref);
   }
+
+  SECTION("Crt resolutions")
+  {
+    // Reference drawing one pixel per cycle like the original fixed 40x6 screen
+    auto drawPerCycle = [&instructions](u32 width, u32 height) {
+      std::vector<bool> pixels(std::size_t{width} * height);
+      CPU cpu{};
+      for (const auto& i : instructions) {
+        CPU before = cpu;
+        cpu.execute(i);
+        for (u64 c = before.cycle; c < cpu.cycle && c < pixels.size(); c++) {
+          if (std::abs(static_cast<i64>(c % width) - before.x) <= 1)
+            pixels[c] = true;
+        }
+      }
+      return pixels;
+    };
+
+    for (auto [width, height] : {std::pair{40u, 6u}, {5u, 60u}, {63u, 4u}, {64u, 4u}, {65u, 4u}, {130u, 3u}}) {
+      CPU cpu{};
+      Crt sized(width, height);
+      simulate(instructions, cpu, sized);
+      auto expected = drawPerCycle(width, height);
+      for (u32 row = 0; row < height; row++) {
+        for (u32 col = 0; col < width; col++)
+          REQUIRE(sized.pixel(col, row) == expected[std::size_t{row} * width + col]);
+      }
+    }
+  }
+}
+
+TEST_CASE("Run many programs")
+{
+  std::vector<std::vector<Instruction>> programs;
+  std::vector<std::string> sources;
+  for (u32 seed = 0; seed < 50; seed++) {
+    programs.push_back(randomProgram(150 + seed, seed));
+    sources.push_back(ranges::accumulate(programs.back(), std::string{}, [](std::string source, Instruction i) {
+      return source + (i.op == Instruction::Op::Addx ? fmt::format("addx {}\n", i.arg) : "noop\n");
+    }));
+  }
+
+  auto expected = programs | ranges::views::transform(runProgram) | ranges::to<std::vector<ProgramResult>>();
+  for (std::size_t threads : {1, 3, 8}) {
+    REQUIRE(runPrograms(programs, threads) == expected);
+    REQUIRE(runPrograms(sources, threads) == expected);
+  }
+
+  // Parse errors on a worker thread reach the caller
+  sources.assign(200, "jump 3\n");
+  REQUIRE_THROWS_AS(runPrograms(sources, 8), std::runtime_error);
+}
+
+TEST_CASE("Timeline benchmark", "[.][benchmark]")
+{
+  auto program = randomProgram(1000000);
+  auto timeline = compileTimeline(program);
+  std::vector<u64> probes = ranges::views::iota(u64{0}, u64{100000}) |
+                            ranges::views::transform([&](u64 i) { return 1 + i * 13 % timeline.totalCycles; }) |
+                            ranges::to<std::vector<u64>>();
+
+  BENCHMARK("Compile 1M instructions")
+  {
+    return compileTimeline(program);
+  };
+  BENCHMARK("100k probes")
+  {
+    return timeline.signalStrength(probes);
+  };
+}
+
+TEST_CASE("Interpreter benchmark", "[.][benchmark]")
+{
+  auto program = randomProgram(10000000);
+  auto decoded = decode(program);
+
+  BENCHMARK("Switch loop, 10M instructions")
+  {
+    CPU cpu{};
+    for (const auto& i : program)
+      cpu.execute(i);
+    return cpu;
+  };
+  BENCHMARK("Threaded dispatch, 10M instructions")
+  {
+    CPU cpu{};
+    run(cpu, decoded);
+    return cpu;
+  };
+}
+
+TEST_CASE("Batch benchmark", "[.][benchmark]")
+{
+  std::vector<std::vector<Instruction>> programs;
+  for (u32 seed = 0; seed < 1000; seed++)
+    programs.push_back(randomProgram(1000, seed));
+
+  BENCHMARK("1000 programs")
+  {
+    return runPrograms(programs);
+  };
 }
 #endif
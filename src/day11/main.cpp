@@ -1,15 +1,177 @@
 #include <common.hpp>
 
+#include <mutex>
+#include <numeric>
+
 // #define RUN_TESTS
 
+// Runtime divisor with a precomputed magic number (Lemire et al., "Faster Remainder by Direct Computation"), so
+// remainders and divisibility checks need two multiplications instead of a 64-bit division. Compilers without 128-bit
+// integers fall back to plain division.
+struct Divisor
+{
+  u64 value{1};
+#ifdef __SIZEOF_INT128__
+  u128 magic{};
+#endif
+
+  constexpr Divisor(u64 value = 1) :
+      value(value)
+  {
+#ifdef __SIZEOF_INT128__
+    magic = ~u128{} / value + 1;
+#endif
+  }
+
+  bool operator==(const Divisor& other) const
+  {
+    return value == other.value;
+  }
+
+  bool divides(u64 n) const
+  {
+#ifdef __SIZEOF_INT128__
+    return magic * n <= magic - 1;
+#else
+    return n % value == 0;
+#endif
+  }
+
+  u64 remainder(u64 n) const
+  {
+#ifdef __SIZEOF_INT128__
+    u128 lowBits = magic * n;
+    // Upper 64 bits of the 192-bit product lowBits * value
+    u128 bottom = ((lowBits & ~u64{}) * value) >> 64;
+    u128 top = (lowBits >> 64) * value;
+    return static_cast<u64>((bottom + top) >> 64);
+#else
+    return n % value;
+#endif
+  }
+
+  // (a + b) mod value, without overflowing for any value
+  u64 add(u64 a, u64 b) const
+  {
+    a = remainder(a);
+    b = remainder(b);
+    return a >= value - b ? a - (value - b) : a + b;
+  }
+
+  // (a * b) mod value, without overflowing for any value
+  u64 multiply(u64 a, u64 b) const
+  {
+#ifdef __SIZEOF_INT128__
+    u128 product = u128{a} * b;
+    if (product >> 64)
+      return static_cast<u64>(product % value);
+    return remainder(static_cast<u64>(product));
+#else
+    if (a <= 0xffff'ffff && b <= 0xffff'ffff)
+      return remainder(a * b);
+    // Double and add, every step stays below value
+    a = remainder(a);
+    u64 result = 0;
+    for (; b != 0; b >>= 1) {
+      if (b & 1)
+        result = add(result, a);
+      a = add(a, a);
+    }
+    return result;
+#endif
+  }
+};
+
+// "new = old <op> <arg>" decoded at parse time
+struct Operation
+{
+  enum class Code : u8
+  {
+    Add,
+    Mul,
+    Square,
+  } code{};
+  u64 constant{};
+
+  bool operator==(const Operation&) const = default;
+
+  u64 operator()(u64 old) const
+  {
+    switch (code) {
+    case Code::Add:
+      return old + constant;
+    case Code::Mul:
+      return old * constant;
+    case Code::Square:
+      return old * old;
+    }
+    unreachable();
+  }
+
+  // Applies the operation modulo the ring value, neither a large ring value nor squaring can overflow
+  u64 operator()(u64 old, const Divisor& ring) const
+  {
+    switch (code) {
+    case Code::Add:
+      return ring.add(old, constant);
+    case Code::Mul:
+      return ring.multiply(old, constant);
+    case Code::Square:
+      return ring.multiply(old, old);
+    }
+    unreachable();
+  }
+};
+
+struct Test
+{
+  Divisor divisor;
+  u64 ifTrue{};
+  u64 ifFalse{};
+
+  bool operator==(const Test&) const = default;
+
+  u64 operator()(u64 value) const
+  {
+    return divisor.divides(value) ? ifTrue : ifFalse;
+  }
+};
+
 struct Monkey
 {
   std::vector<u64> items;
-  std::function<u64(u64)> operation;
-  std::function<u64(u64)> test;
-  u64 divisbleBy;
+  Operation operation;
+  Test test;
 };
 
+template <>
+Operation fromString(std::string_view v)
+{
+  std::string arg1;
+  std::string op;
+  std::string arg2;
+  if (!scn::scan(v, "{} {} {}", arg1, op, arg2))
+    throw std::runtime_error("Parsing error");
+  if (arg1 != "old")
+    std::swap(arg1, arg2);
+  if (arg1 != "old")
+    throw std::runtime_error("Operation does not use old");
+
+  if (arg2 == "old") {
+    if (op == "+")
+      return {Operation::Code::Mul, 2};
+    if (op == "*")
+      return {Operation::Code::Square};
+  } else {
+    auto constant = static_cast<u64>(std::stoull(arg2));
+    if (op == "+")
+      return {Operation::Code::Add, constant};
+    if (op == "*")
+      return {Operation::Code::Mul, constant};
+  }
+  throw std::runtime_error("Invalid operation");
+}
+
 template <>
 Monkey fromString(std::string_view v)
 {
@@ -27,29 +189,14 @@ Monkey fromString(std::string_view v)
   // Operation
   std::tie(line, rest) = getline(rest);
   line.remove_prefix("  Operation: new = "sv.size());
-  std::string arg1;
-  std::string op;
-  std::string arg2;
-  if (!scn::scan(line, "{} {} {}", arg1, op, arg2))
-    throw std::runtime_error("Parsing error");
-
-  monkey.operation = [arg1, op, arg2](u64 old) {
-    u64 x = arg1 == "old" ? old : static_cast<u64>(std::stoi(arg1));
-    u64 y = arg2 == "old" ? old : static_cast<u64>(std::stoi(arg2));
-    if (op == "+")
-      return x + y;
-    if (op == "*")
-      return x * y;
-    throw std::runtime_error("Invalid operation");
-  };
+  monkey.operation = fromString<Operation>(line);
 
   // Test
   std::tie(line, rest) = getline(rest);
   line.remove_prefix("  Test: divisible by "sv.size());
   u64 divisibleBy;
-  if (!scn::scan(line, "{}", divisibleBy))
+  if (!scn::scan(line, "{}", divisibleBy) || divisibleBy == 0)
     throw std::runtime_error("Parsing error");
-  monkey.divisbleBy = divisibleBy;
 
   std::tie(line, rest) = getline(rest);
   line.remove_prefix("    If true: throw to monkey "sv.size());
@@ -63,7 +210,7 @@ Monkey fromString(std::string_view v)
   if (!scn::scan(line, "{}", monkeyIfFalse))
     throw std::runtime_error("Parsing error");
 
-  monkey.test = [=](u64 value) { return (value % divisibleBy == 0) ? monkeyIfTrue : monkeyIfFalse; };
+  monkey.test = {divisibleBy, monkeyIfTrue, monkeyIfFalse};
 
   return monkey;
 }
@@ -82,33 +229,217 @@ std::vector<Monkey> parseMonkeys(std::istream&& input)
          ranges::views::transform(fromString<Monkey>) | ranges::to<std::vector<Monkey>>;
 }
 
+// Smallest value all divisors divide, worry levels modulo it keep the results of all tests
+u64 ringValueOf(const std::vector<Monkey>& monkeys)
+{
+  u64 ringValue = 1;
+  for (const auto& monkey : monkeys) {
+    u64 factor = monkey.test.divisor.value / std::gcd(ringValue, monkey.test.divisor.value);
+    if (ringValue > std::numeric_limits<u64>::max() / factor)
+      throw std::runtime_error("Ring value does not fit into 64 bits");
+    ringValue *= factor;
+  }
+  return ringValue;
+}
+
+// All items in one flat pool, every monkey holds a queue of item indices linked through the pool. Memory only grows
+// with the number of items and monkeys, moving an item between monkeys never allocates.
+struct ItemQueues
+{
+  static constexpr u32 End = std::numeric_limits<u32>::max();
+
+  std::vector<u64> worry;
+  // Next item in the same queue
+  std::vector<u32> next;
+  std::vector<u32> heads;
+  std::vector<u32> tails;
+  std::vector<std::size_t> sizes;
+
+  explicit ItemQueues(const std::vector<Monkey>& monkeys) :
+      heads(monkeys.size(), End), tails(monkeys.size(), End), sizes(monkeys.size())
+  {
+    for (std::size_t monkeyId = 0; monkeyId < monkeys.size(); monkeyId++) {
+      for (auto item : monkeys[monkeyId].items) {
+        worry.push_back(item);
+        next.push_back(End);
+        push(monkeyId, static_cast<u32>(worry.size() - 1));
+      }
+    }
+  }
+
+  std::size_t size(std::size_t monkeyId) const
+  {
+    return sizes[monkeyId];
+  }
+
+  void push(std::size_t monkeyId, u32 item)
+  {
+    next[item] = End;
+    if (tails[monkeyId] == End)
+      heads[monkeyId] = item;
+    else
+      next[tails[monkeyId]] = item;
+    tails[monkeyId] = item;
+    sizes[monkeyId]++;
+  }
+
+  // Removes the first item of a monkey and returns its index into the pool
+  u32 pop(std::size_t monkeyId)
+  {
+    u32 item = heads[monkeyId];
+    heads[monkeyId] = next[item];
+    if (heads[monkeyId] == End)
+      tails[monkeyId] = End;
+    sizes[monkeyId]--;
+    return item;
+  }
+};
+
 // Returns monkey inspect count
-std::vector<u64> simulateRounds(std::vector<Monkey> monkeys, u32 numberOfRounds, bool divideWorryLevel = true)
+std::vector<u64> simulateRounds(const std::vector<Monkey>& monkeys, u32 numberOfRounds, bool divideWorryLevel = true)
 {
-  u64 ringValue = ranges::accumulate(monkeys, 1ull, [](u64 v, const Monkey& m) { return v * m.divisbleBy; });
+  // Worry levels only stay bounded by the ring value if they are not divided
+  Divisor ring = divideWorryLevel ? Divisor{} : Divisor{ringValueOf(monkeys)};
+  ItemQueues queues(monkeys);
   std::vector<u64> monkeyInspectCounts(monkeys.size());
   for (u32 r = 0; r < numberOfRounds; r++) {
     for (std::size_t monkeyId{}; monkeyId < monkeys.size(); monkeyId++) {
-      auto& monkey = monkeys[monkeyId];
+      const auto& monkey = monkeys[monkeyId];
 
-      // Inspect items
-      monkeyInspectCounts[monkeyId] += monkey.items.size();
-      for (auto& item : monkey.items) {
-        item = monkey.operation(item);
+      // Inspect items, an item thrown to the monkey itself waits for the next round
+      auto itemCount = queues.size(monkeyId);
+      monkeyInspectCounts[monkeyId] += itemCount;
+      for (std::size_t i = 0; i < itemCount; i++) {
+        u32 item = queues.pop(monkeyId);
+        u64& worry = queues.worry[item];
         if (divideWorryLevel) {
-          item /= 3;
+          worry = monkey.operation(worry) / 3;
         } else {
-          item = item % ringValue;
+          worry = monkey.operation(worry, ring);
         }
-        auto throw_to = monkey.test(item);
-        monkeys[throw_to].items.push_back(item);
+        queues.push(monkey.test(worry), item);
       }
-      monkey.items.clear();
     }
   }
   return monkeyInspectCounts;
 }
 
+// Where an item is at the start of a round, worry is kept modulo the ring value
+struct ItemState
+{
+  std::size_t monkeyId{};
+  u64 worry{};
+
+  bool operator==(const ItemState&) const = default;
+};
+
+// Moves an item through one round and adds its inspections to inspectCounts. An item thrown to a monkey with a higher
+// id is inspected again in the same round, otherwise in the next one.
+ItemState traceRound(const std::vector<Monkey>& monkeys, const Divisor& ring, ItemState item,
+                     std::vector<u64>& inspectCounts)
+{
+  while (true) {
+    const auto& monkey = monkeys[item.monkeyId];
+    inspectCounts[item.monkeyId]++;
+    item.worry = monkey.operation(item.worry, ring);
+    auto throwTo = monkey.test(item.worry);
+    bool nextRound = throwTo <= item.monkeyId;
+    item.monkeyId = throwTo;
+    if (nextRound)
+      return item;
+  }
+}
+
+ItemState traceRounds(const std::vector<Monkey>& monkeys, const Divisor& ring, ItemState item, u64 numberOfRounds,
+                      std::vector<u64>& inspectCounts)
+{
+  for (u64 round = 0; round < numberOfRounds; round++)
+    item = traceRound(monkeys, ring, item, inspectCounts);
+  return item;
+}
+
+// There are only monkeys * ringValue states, so every item ends up in a cycle of rounds. The cycle is found with
+// Brent's algorithm, the inspections of all full cycles are then multiplied instead of simulated. Falls back to plain
+// tracing if no cycle shows up within the requested rounds.
+void traceItem(const std::vector<Monkey>& monkeys, const Divisor& ring, ItemState start, u64 numberOfRounds,
+               std::vector<u64>& inspectCounts)
+{
+  std::vector<u64> ignored(monkeys.size());
+  auto next = [&](ItemState item) { return traceRound(monkeys, ring, item, ignored); };
+
+  // Cycle length
+  u64 power = 1;
+  u64 cycleLength = 1;
+  ItemState tortoise = start;
+  ItemState hare = next(start);
+  for (u64 steps = 1; tortoise != hare; steps++) {
+    if (steps >= numberOfRounds) {
+      traceRounds(monkeys, ring, start, numberOfRounds, inspectCounts);
+      return;
+    }
+    if (power == cycleLength) {
+      tortoise = hare;
+      power *= 2;
+      cycleLength = 0;
+    }
+    hare = next(hare);
+    cycleLength++;
+  }
+
+  // Rounds before the cycle starts
+  u64 cycleStart = 0;
+  tortoise = start;
+  hare = start;
+  for (u64 i = 0; i < cycleLength; i++)
+    hare = next(hare);
+  while (tortoise != hare) {
+    tortoise = next(tortoise);
+    hare = next(hare);
+    cycleStart++;
+  }
+
+  if (numberOfRounds <= cycleStart + cycleLength) {
+    traceRounds(monkeys, ring, start, numberOfRounds, inspectCounts);
+    return;
+  }
+
+  auto item = traceRounds(monkeys, ring, start, cycleStart, inspectCounts);
+  std::vector<u64> cycleCounts(monkeys.size());
+  traceRounds(monkeys, ring, item, cycleLength, cycleCounts);
+
+  u64 remaining = numberOfRounds - cycleStart;
+  for (std::size_t i = 0; i < monkeys.size(); i++)
+    inspectCounts[i] += cycleCounts[i] * (remaining / cycleLength);
+  traceRounds(monkeys, ring, item, remaining % cycleLength, inspectCounts);
+}
+
+// Same result as simulateRounds without dividing the worry level. Items never interact in that mode, so every item is
+// traced on its own and the items are split between threads. Thanks to the cycle detection in traceItem the number of
+// rounds can go far beyond what could be simulated.
+std::vector<u64> simulateItemsIndependently(const std::vector<Monkey>& monkeys, u64 numberOfRounds,
+                                            std::size_t threadCount = std::thread::hardware_concurrency())
+{
+  Divisor ring{ringValueOf(monkeys)};
+  std::vector<ItemState> items;
+  for (std::size_t monkeyId{}; monkeyId < monkeys.size(); monkeyId++) {
+    for (u64 item : monkeys[monkeyId].items)
+      items.push_back({monkeyId, ring.remainder(item)});
+  }
+
+  std::vector<u64> inspectCounts(monkeys.size());
+  std::mutex inspectCountsMutex;
+  parallelFor(items.size(), threadCount, [&](std::size_t begin, std::size_t end) {
+    std::vector<u64> counts(monkeys.size());
+    for (std::size_t i = begin; i < end; i++)
+      traceItem(monkeys, ring, items[i], numberOfRounds, counts);
+
+    std::lock_guard lock(inspectCountsMutex);
+    for (std::size_t i = 0; i < counts.size(); i++)
+      inspectCounts[i] += counts[i];
+  });
+  return inspectCounts;
+}
+
 u64 calculateMonkeyBusiness(std::vector<u64> inspectCounts)
 {
   auto maxElement = ranges::max_element(inspectCounts);
@@ -131,12 +462,44 @@ auto main() -> int
   }
   {
     auto monkeys = parseMonkeys(std::fstream("../../src/day11/input.txt"));
-    auto inspectCounts = simulateRounds(monkeys, 10000, false);
+    auto inspectCounts = simulateItemsIndependently(monkeys, 10000);
     fmt::print("Task2 Result: {}\n", calculateMonkeyBusiness(inspectCounts));
   }
 }
 
 #else
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+#include <random>
+
+constexpr auto exampleMonkeys = 1 + R"(
+Monkey 0:
+  Starting items: 79, 98
+  Operation: new = old * 19
+  Test: divisible by 23
+    If true: throw to monkey 2
+    If false: throw to monkey 3
+
+Monkey 1:
+  Starting items: 54, 65, 75, 74
+  Operation: new = old + 6
+  Test: divisible by 19
+    If true: throw to monkey 2
+    If false: throw to monkey 0
+
+Monkey 2:
+  Starting items: 79, 60, 97
+  Operation: new = old * old
+  Test: divisible by 13
+    If true: throw to monkey 1
+    If false: throw to monkey 3
+
+Monkey 3:
+  Starting items: 74
+  Operation: new = old + 3
+  Test: divisible by 17
+    If true: throw to monkey 0
+    If false: throw to monkey 1)";
 
 TEST_CASE("Parse Monkey")
 {
@@ -169,38 +532,71 @@ TEST_CASE("Parse Monkey")
   }
 }
 
-TEST_CASE("Example")
+TEST_CASE("Parse operation")
 {
-  std::string input = 1 + R"(
-Monkey 0:
-  Starting items: 79, 98
-  Operation: new = old * 19
-  Test: divisible by 23
-    If true: throw to monkey 2
-    If false: throw to monkey 3
+  using C = Operation::Code;
+  REQUIRE(fromString<Operation>("old + 6") == Operation{C::Add, 6});
+  REQUIRE(fromString<Operation>("6 + old") == Operation{C::Add, 6});
+  REQUIRE(fromString<Operation>("old * 19") == Operation{C::Mul, 19});
+  REQUIRE(fromString<Operation>("old * old") == Operation{C::Square});
+  REQUIRE(fromString<Operation>("old + old") == Operation{C::Mul, 2});
+  REQUIRE_THROWS(fromString<Operation>("old - 1"));
+  REQUIRE_THROWS(fromString<Operation>("1 + 2"));
+}
 
-Monkey 1:
-  Starting items: 54, 65, 75, 74
-  Operation: new = old + 6
-  Test: divisible by 19
-    If true: throw to monkey 2
-    If false: throw to monkey 0
+TEST_CASE("Divisor")
+{
+  std::mt19937_64 rng(11);
+  for (u64 value : {1ull, 2ull, 3ull, 23ull, 96577ull, 9699690ull, (1ull << 32) + 15, ~0ull}) {
+    Divisor divisor{value};
+    for (int i = 0; i < 10000; i++) {
+      u64 n = i < 100 ? static_cast<u64>(i) : rng() >> (i % 64);
+      REQUIRE(divisor.remainder(n) == n % value);
+      REQUIRE(divisor.divides(n) == (n % value == 0));
+      REQUIRE(divisor.divides(n / value * value));
 
-Monkey 2:
-  Starting items: 79, 60, 97
-  Operation: new = old * old
-  Test: divisible by 13
-    If true: throw to monkey 1
-    If false: throw to monkey 3
+#ifdef __SIZEOF_INT128__
+      u64 m = rng();
+      REQUIRE(divisor.add(n, m) == static_cast<u64>((u128{n} + m) % value));
+      REQUIRE(divisor.multiply(n, m) == static_cast<u64>(u128{n} * m % value));
+#endif
+    }
+    REQUIRE(divisor.add(value - 1, 1) == 0);
+    REQUIRE(divisor.multiply(value - 1, value - 1) == 1 % value);
+  }
+}
 
-Monkey 3:
-  Starting items: 74
-  Operation: new = old + 3
-  Test: divisible by 17
-    If true: throw to monkey 0
-    If false: throw to monkey 1)";
+TEST_CASE("Large ring value")
+{
+  auto monkeys = parseMonkeys(std::stringstream(exampleMonkeys));
+  // Ring value close to 2^63, squaring a worry level below it overflows 64 bits
+  monkeys[0].test.divisor = 4294967311;
+  monkeys[1].test.divisor = 2147483659;
+  monkeys[2].test.divisor = 1;
+  monkeys[3].test.divisor = 1;
+  u64 ringValue = ringValueOf(monkeys);
+  REQUIRE(ringValue == 4294967311ull * 2147483659ull);
+
+  Divisor ring{ringValue};
+  u64 worry = ringValue - 1;
+  REQUIRE(monkeys[2].operation(worry, ring) == 1);
+  REQUIRE(simulateItemsIndependently(monkeys, 10000) == simulateRounds(monkeys, 10000, false));
+
+  monkeys[2].test.divisor = 3;
+  REQUIRE_THROWS(ringValueOf(monkeys));
+  REQUIRE_THROWS(simulateRounds(monkeys, 20, false));
+
+  // Dividing the worry level does not need the ring value
+  monkeys[0].test.divisor = 4294967311;
+  monkeys[1].test.divisor = 4294967357;
+  monkeys[2].test.divisor = 13;
+  REQUIRE_THROWS(ringValueOf(monkeys));
+  REQUIRE(ranges::accumulate(simulateRounds(monkeys, 20), u64{}) > 0);
+}
 
-  auto monkeys = parseMonkeys(std::stringstream(input));
+TEST_CASE("Example")
+{
+  auto monkeys = parseMonkeys(std::stringstream(exampleMonkeys));
 
   SECTION("Parse monkeys")
   {
@@ -208,6 +604,8 @@ Monkey 3:
     REQUIRE(monkeys[0].items == std::vector<u64>{79, 98});
     REQUIRE(monkeys[3].items == std::vector<u64>{74});
     REQUIRE(monkeys[3].operation(3) == 6);
+    REQUIRE(monkeys[2].operation == Operation{Operation::Code::Square});
+    REQUIRE(monkeys[2].test == Test{13, 1, 3});
     REQUIRE(monkeys[3].test(17) == 0);
     REQUIRE(monkeys[3].test(18) == 1);
   }
@@ -226,6 +624,89 @@ Monkey 3:
     REQUIRE(simulateRounds(monkeys, 20, false) == std::vector<u64>{99, 97, 8, 103});
     REQUIRE(calculateMonkeyBusiness(inspectCounts) == 2713310158);
   }
+
+  SECTION("Independent items")
+  {
+    for (u64 rounds : {1, 2, 3, 20, 777, 10000, 54321}) {
+      for (std::size_t threads : {1, 3, 16})
+        REQUIRE(simulateItemsIndependently(monkeys, rounds, threads) == simulateRounds(monkeys, rounds, false));
+    }
+
+    u64 rounds = 1'000'000'000'000;
+    auto inspectCounts = simulateItemsIndependently(monkeys, rounds);
+    // Every item is inspected at least once per round
+    REQUIRE(ranges::accumulate(inspectCounts, u64{}) >= 10 * rounds);
+
+    std::vector<u64> plain(monkeys.size());
+    std::vector<u64> fastForwarded(monkeys.size());
+    ItemState item{0, 79};
+    traceRounds(monkeys, ringValueOf(monkeys), item, 100000, plain);
+    traceItem(monkeys, ringValueOf(monkeys), item, 100000, fastForwarded);
+    REQUIRE(plain == fastForwarded);
+  }
+}
+
+TEST_CASE("Inspection benchmark", "[.][benchmark]")
+{
+  auto monkeys = parseMonkeys(std::stringstream(exampleMonkeys));
+
+  // What every inspection cost before the operations were decoded
+  auto stringOperation = [arg1 = "old"s, op = "*"s, arg2 = "19"s](u64 old) {
+    u64 x = arg1 == "old" ? old : static_cast<u64>(std::stoi(arg1));
+    u64 y = arg2 == "old" ? old : static_cast<u64>(std::stoi(arg2));
+    if (op == "+")
+      return x + y;
+    if (op == "*")
+      return x * y;
+    throw std::runtime_error("Invalid operation");
+  };
+  std::function<u64(u64)> closure = stringOperation;
+  Operation decoded = monkeys[0].operation;
+
+  BENCHMARK("1M string closure inspections")
+  {
+    u64 sum{};
+    for (u64 i = 0; i < 1000000; i++)
+      sum += closure(i);
+    return sum;
+  };
+  BENCHMARK("1M decoded inspections")
+  {
+    u64 sum{};
+    for (u64 i = 0; i < 1000000; i++)
+      sum += decoded(i);
+    return sum;
+  };
+  std::vector<u64> values(1000000);
+  ranges::generate(values, std::mt19937_64(11));
+  volatile u64 ringValue = 96577;
+  Divisor ring{ringValue};
+  BENCHMARK("1M remainders by division")
+  {
+    u64 sum{};
+    for (u64 v : values)
+      sum += v % ringValue;
+    return sum;
+  };
+  BENCHMARK("1M remainders by precomputed divisor")
+  {
+    u64 sum{};
+    for (u64 v : values)
+      sum += ring.remainder(v);
+    return sum;
+  };
+  BENCHMARK("10000 rounds")
+  {
+    return simulateRounds(monkeys, 10000, false);
+  };
+  BENCHMARK("10000 rounds, independent items")
+  {
+    return simulateItemsIndependently(monkeys, 10000);
+  };
+  BENCHMARK("10^12 rounds, independent items")
+  {
+    return simulateItemsIndependently(monkeys, 1'000'000'000'000);
+  };
 }
 
 #endif
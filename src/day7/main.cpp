@@ -1,7 +1,18 @@
 #include <common.hpp>
 
+#include <limits>
+#include <optional>
+#include <type_traits>
 #include <variant>
 
+#if __has_include(<sys/mman.h>)
+#define AOC_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 // #define RUN_TESTS
 
 struct Command
@@ -50,123 +61,474 @@ std::vector<HistoryEntry> parseHistory(std::istream&& input)
          ranges::to<std::vector<HistoryEntry>>();
 }
 
-struct File
+using NameId = u32;
+using NodeId = u32;
+constexpr u32 InvalidIndex = std::numeric_limits<u32>::max();
+
+// Stores every distinct name once, nodes only keep the 32 bit id
+struct NameTable
 {
-  std::string name;
-  u64 size;
+  struct Hash
+  {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view v) const
+    {
+      return std::hash<std::string_view>{}(v);
+    }
+  };
 
-  bool operator<=>(const File&) const = default;
+  std::vector<std::string> names;
+  std::unordered_map<std::string, NameId, Hash, std::equal_to<>> ids;
+
+  NameId intern(std::string_view name)
+  {
+    if (auto found = ids.find(name); found != ids.end())
+      return found->second;
+    auto id = static_cast<NameId>(names.size());
+    names.emplace_back(name);
+    ids.emplace(names.back(), id);
+    return id;
+  }
+
+  const std::string& operator[](NameId id) const
+  {
+    return names[id];
+  }
 };
 
-struct Directory
+struct DirNode
 {
-  std::string name;
-  std::vector<Directory> dirs;
-  std::vector<File> files;
+  NodeId parent{InvalidIndex};
+  NodeId firstChild{InvalidIndex};
+  NodeId nextSibling{InvalidIndex};
+  u32 firstFile{InvalidIndex};
+  NameId name{};
 
-  std::size_t size{};
+  u64 size{};
+};
 
-  bool operator==(const Directory&) const = default;
+struct FileNode
+{
+  NameId name{};
+  u32 nextFile{InvalidIndex};
+  u64 size{};
 };
 
-Directory parseFilesystemFromHistory(const std::vector<HistoryEntry>& history, bool storeDirSizes = true)
+// Directory tree stored as flat node tables. Nodes reference each other by index, so growing the tables never
+// invalidates a reference. A child is always created after its parent, therefore its index is always larger.
+struct Filesystem
 {
-  if (std::get<Command>(history[0]) != Command{Command::Type::ChangeDirectory, "/"})
-    throw std::runtime_error("First cmd has to be cd /!");
-  Directory root{"/"};
+  static constexpr NodeId root = 0;
+
+  NameTable names;
+  std::vector<DirNode> dirs;
+  std::vector<FileNode> files;
+  // (parent, name) -> child, keeps lookups in wide directories O(1)
+  std::unordered_map<u64, NodeId> childIndex;
 
-  std::vector<Directory*> cwd;
-  cwd.push_back(&root);
+  Filesystem()
+  {
+    dirs.push_back({.name = names.intern("/")});
+  }
+
+  static u64 childKey(NodeId parent, NameId name)
+  {
+    return (static_cast<u64>(parent) << 32) | name;
+  }
+
+  NodeId findDir(NodeId parent, NameId name) const
+  {
+    auto found = childIndex.find(childKey(parent, name));
+    return found != childIndex.end() ? found->second : InvalidIndex;
+  }
+
+  // Returns the existing directory if there is one with the same name
+  NodeId addDir(NodeId parent, std::string_view name)
+  {
+    auto nameId = names.intern(name);
+    auto [found, inserted] = childIndex.try_emplace(childKey(parent, nameId), static_cast<NodeId>(dirs.size()));
+    if (!inserted)
+      return found->second;
+
+    auto id = found->second;
+    dirs.push_back({.parent = parent, .nextSibling = dirs[parent].firstChild, .name = nameId});
+    dirs[parent].firstChild = id;
+    return id;
+  }
 
-  auto create_dir = [&](const std::string& name, bool enter) {
-    auto found = ranges::find_if(cwd.back()->dirs, [&](const Directory& d) { return d.name == name; });
-    if (found != cwd.back()->dirs.end()) {
-      if (enter)
-        cwd.push_back(&*found);
+  void addFile(NodeId dir, std::string_view name, u64 size)
+  {
+    files.push_back({.name = names.intern(name), .nextFile = dirs[dir].firstFile, .size = size});
+    dirs[dir].firstFile = static_cast<u32>(files.size() - 1);
+  }
+};
+
+enum class DirSizes
+{
+  None,
+  // Every file adds its size to all ancestors while parsing, O(files * depth)
+  Eager,
+  // Files only add to their own directory, one post order pass sums up the tree afterwards, O(files + dirs)
+  Deferred,
+};
+
+// Adds the size of every directory to its parent. Children always come after their parent in the table, so walking
+// it backwards visits the tree in post order.
+void aggregateDirSizes(Filesystem& fs)
+{
+  for (std::size_t i = fs.dirs.size() - 1; i > 0; i--) {
+    fs.dirs[fs.dirs[i].parent].size += fs.dirs[i].size;
+  }
+}
+
+// Applies shell log lines to a filesystem, shared by the history and the streaming ingestion
+struct FilesystemBuilder
+{
+  Filesystem fs;
+  NodeId cwd{Filesystem::root};
+  DirSizes dirSizes{DirSizes::Eager};
+  // Bytes applied by addLines so far, a line that throws is not counted
+  std::size_t consumed{};
+
+  void changeDirectory(std::string_view arg)
+  {
+    if (arg == "..") {
+      // Like in a shell, going up from the root stays at the root
+      if (cwd != Filesystem::root)
+        cwd = fs.dirs[cwd].parent;
+    } else if (arg == "/") {
+      cwd = Filesystem::root;
     } else {
-      cwd.back()->dirs.emplace_back(name);
-      if (enter)
-        cwd.push_back(&cwd.back()->dirs.back());
+      cwd = fs.addDir(cwd, arg);
     }
-  };
+  }
 
-  for (bool first{true}; auto& entry : history) {
-    if (first) {
-      first = false;
-      continue;
+  // Handles a "dir <name>" or "<size> <name>" line of ls output
+  void addListing(std::string_view line)
+  {
+    if (line[0] == 'd') {
+      fs.addDir(cwd, line.substr(4));
+      return;
     }
 
-    const Command* cmd = std::get_if<Command>(&entry);
-    const std::string* output = std::get_if<std::string>(&entry);
+    u64 size{};
+    auto [end, ec] = std::from_chars(line.data(), line.data() + line.size(), size);
+    if (ec != std::errc() || end == line.data() + line.size())
+      throw std::runtime_error("Invalid file entry");
+    fs.addFile(cwd, line.substr(end - line.data() + 1), size);
 
-    if (cmd) {
-      if (cmd->cmd == Command::Type::ChangeDirectory) {
-        if (cmd->arg == "..") {
-          cwd.pop_back();
-        } else {
-          create_dir(cmd->arg, true);
-        }
-      }
-    } else if (output) {
-      if ((*output)[0] == 'd') {
-        create_dir(std::string(output->substr(4)), false);
-      } else {
-        auto space_loc = output->find_first_of(' ');
-        std::string name = std::string(output->substr(space_loc + 1, output->size() - space_loc - 1));
-        int size = std::atoi(output->c_str());
-        cwd.back()->files.emplace_back(name, size);
-
-        if (storeDirSizes) {
-          for (auto& dir : cwd) {
-            dir->size += size;
-          }
-        }
+    if (dirSizes == DirSizes::Eager) {
+      for (NodeId dir = cwd; dir != InvalidIndex; dir = fs.dirs[dir].parent) {
+        fs.dirs[dir].size += size;
       }
+    } else if (dirSizes == DirSizes::Deferred) {
+      fs.dirs[cwd].size += size;
     }
   }
 
-  return root;
+  Filesystem finish()
+  {
+    if (dirSizes == DirSizes::Deferred)
+      aggregateDirSizes(fs);
+    return std::move(fs);
+  }
+
+  void addLine(std::string_view line)
+  {
+    if (line.empty())
+      return;
+    if (line.starts_with("$ cd "))
+      changeDirectory(line.substr(5));
+    else if (line[0] != '$')
+      addListing(line);
+  }
+
+  // Applies the log line by line and returns the number of bytes consumed. With completeLinesOnly a last line without
+  // newline is left for later, it might still be written to.
+  std::size_t addLines(std::string_view log, bool completeLinesOnly = false)
+  {
+    std::size_t position{};
+    while (position < log.size()) {
+      auto lineEnd = log.find('\n', position);
+      if (lineEnd == std::string_view::npos && completeLinesOnly)
+        break;
+
+      auto next = lineEnd != std::string_view::npos ? lineEnd + 1 : log.size();
+      auto line = log.substr(position, (lineEnd != std::string_view::npos ? lineEnd : log.size()) - position);
+      if (line.ends_with('\r'))
+        line.remove_suffix(1);
+      addLine(line);
+      consumed += next - position;
+      position = next;
+    }
+    return position;
+  }
+};
+
+void checkLogStart(std::string_view log)
+{
+  auto line = log.substr(0, log.find('\n'));
+  if (line.ends_with('\r'))
+    line.remove_suffix(1);
+  if (line != "$ cd /")
+    throw std::runtime_error("First cmd has to be cd /!");
 }
 
-u64 dirSizeSumWithThreshold(const Directory& dir, u64 threshold)
+Filesystem parseFilesystemFromHistory(const std::vector<HistoryEntry>& history, DirSizes dirSizes = DirSizes::Eager)
 {
-  u64 sum{};
-  std::stack<const Directory*> stack;
-  stack.push(&dir);
+  if (std::get<Command>(history[0]) != Command{Command::Type::ChangeDirectory, "/"})
+    throw std::runtime_error("First cmd has to be cd /!");
+  FilesystemBuilder builder{.dirSizes = dirSizes};
 
-  while (!stack.empty()) {
-    const Directory* dir = stack.top();
-    stack.pop();
+  for (const auto& entry : history | ranges::views::drop(1)) {
+    if (const Command* cmd = std::get_if<Command>(&entry)) {
+      if (cmd->cmd == Command::Type::ChangeDirectory)
+        builder.changeDirectory(cmd->arg);
+    } else {
+      builder.addListing(std::get<std::string>(entry));
+    }
+  }
 
-    if (dir->size < threshold)
-      sum += dir->size;
+  return builder.finish();
+}
+
+// Builds the filesystem in a single pass over the raw log, without materializing any line
+Filesystem ingestLog(std::string_view log, DirSizes dirSizes = DirSizes::Eager)
+{
+  checkLogStart(log);
+  FilesystemBuilder builder{.dirSizes = dirSizes};
+  builder.addLines(log);
+  return builder.finish();
+}
+
+// Ingestion state that can be stored and resumed once more lines got appended to the log
+struct FilesystemSnapshot
+{
+  Filesystem fs;
+  NodeId cwd{Filesystem::root};
+  // Bytes of the log already applied, always at the start of a line
+  u64 logOffset{};
+};
 
-    for (auto& d : dir->dirs)
-      stack.push(&d);
+// Applies everything appended to the log since the snapshot was taken. Sizes are added to the ancestors right away,
+// so the cost only depends on the new lines.
+void ingestLogTail(FilesystemSnapshot& snapshot, std::string_view log)
+{
+  if (log.size() < snapshot.logOffset)
+    throw std::runtime_error("Log is shorter than the snapshot");
+  if (snapshot.logOffset == 0) {
+    // The first line may still be incomplete as well
+    if (log.find('\n') == std::string_view::npos)
+      return;
+    checkLogStart(log);
   }
 
-  return sum;
+  // Lines are applied one by one, so on an invalid line the snapshot keeps everything before it and points at it
+  FilesystemBuilder builder{std::move(snapshot.fs), snapshot.cwd, DirSizes::Eager};
+  auto commit = [&] {
+    snapshot.logOffset += builder.consumed;
+    snapshot.cwd = builder.cwd;
+    snapshot.fs = std::move(builder.fs);
+  };
+  try {
+    builder.addLines(log.substr(snapshot.logOffset), true);
+  } catch (...) {
+    commit();
+    throw;
+  }
+  commit();
 }
 
-u64 freeSpace(const Directory& dir, u64 diskSpace, u64 targetFreeSpace)
+constexpr u64 SnapshotMagic = 0x3130'5041'4e53'3741; // "A7SNAP01"
+
+template <typename T>
+void writeBinary(std::ostream& output, const T& value)
 {
-  auto toFree = targetFreeSpace - (diskSpace - dir.size);
+  static_assert(std::is_trivially_copyable_v<T>);
+  output.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
 
-  const Directory* smallest = nullptr;
-  std::stack<const Directory*> stack;
-  stack.push(&dir);
+template <typename T>
+void writeBinary(std::ostream& output, const std::vector<T>& values)
+{
+  static_assert(std::is_trivially_copyable_v<T>);
+  writeBinary(output, static_cast<u64>(values.size()));
+  output.write(reinterpret_cast<const char*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(T)));
+}
 
-  while (!stack.empty()) {
-    const Directory* dir = stack.top();
-    stack.pop();
+template <typename T>
+void readBinary(std::istream& input, T& value)
+{
+  static_assert(std::is_trivially_copyable_v<T>);
+  if (!input.read(reinterpret_cast<char*>(&value), sizeof(T)))
+    throw std::runtime_error("Truncated snapshot");
+}
 
-    if (dir->size >= toFree) {
-      if (!smallest || smallest->size > dir->size)
-        smallest = dir;
+template <typename T>
+void readBinary(std::istream& input, std::vector<T>& values)
+{
+  u64 size{};
+  readBinary(input, size);
+  values.resize(size);
+  if (!input.read(reinterpret_cast<char*>(values.data()), static_cast<std::streamsize>(size * sizeof(T))))
+    throw std::runtime_error("Truncated snapshot");
+}
+
+// Stores the node tables as they are in memory, the hash indices are rebuilt on load
+void saveSnapshot(const FilesystemSnapshot& snapshot, std::ostream&& output)
+{
+  writeBinary(output, SnapshotMagic);
+  writeBinary(output, snapshot.logOffset);
+  writeBinary(output, snapshot.cwd);
+  writeBinary(output, snapshot.fs.dirs);
+  writeBinary(output, snapshot.fs.files);
+
+  writeBinary(output, static_cast<u64>(snapshot.fs.names.names.size()));
+  for (const auto& name : snapshot.fs.names.names) {
+    writeBinary(output, static_cast<u32>(name.size()));
+    output.write(name.data(), static_cast<std::streamsize>(name.size()));
+  }
+
+  if (!output)
+    throw std::runtime_error("Cannot write snapshot");
+}
+
+FilesystemSnapshot loadSnapshot(std::istream&& input)
+{
+  u64 magic{};
+  readBinary(input, magic);
+  if (magic != SnapshotMagic)
+    throw std::runtime_error("Not a filesystem snapshot");
+
+  FilesystemSnapshot snapshot;
+  auto& fs = snapshot.fs;
+  readBinary(input, snapshot.logOffset);
+  readBinary(input, snapshot.cwd);
+  readBinary(input, fs.dirs);
+  readBinary(input, fs.files);
+
+  u64 nameCount{};
+  readBinary(input, nameCount);
+  fs.names = {};
+  for (u64 i = 0; i < nameCount; i++) {
+    u32 length{};
+    readBinary(input, length);
+    std::string name(length, '\0');
+    if (!input.read(name.data(), length))
+      throw std::runtime_error("Truncated snapshot");
+    fs.names.intern(name);
+  }
+
+  // Every index has to point into the tables, following the order the builder creates nodes in. Links only go to
+  // smaller indices, except for a first child, so no chain can loop.
+  auto valid = [&] {
+    if (fs.names.names.size() != nameCount || fs.dirs.empty() || snapshot.cwd >= fs.dirs.size() ||
+        fs.dirs[Filesystem::root].parent != InvalidIndex || fs.dirs[Filesystem::root].nextSibling != InvalidIndex)
+      return false;
+    for (NodeId i = 0; i < fs.dirs.size(); i++) {
+      const auto& dir = fs.dirs[i];
+      if (i != Filesystem::root && dir.parent >= i)
+        return false;
+      if (dir.firstChild != InvalidIndex &&
+          (dir.firstChild <= i || dir.firstChild >= fs.dirs.size() || fs.dirs[dir.firstChild].parent != i))
+        return false;
+      if (dir.nextSibling != InvalidIndex && (dir.nextSibling >= i || fs.dirs[dir.nextSibling].parent != dir.parent))
+        return false;
+      if ((dir.firstFile != InvalidIndex && dir.firstFile >= fs.files.size()) || dir.name >= nameCount)
+        return false;
+    }
+    for (u32 i = 0; i < fs.files.size(); i++) {
+      if ((fs.files[i].nextFile != InvalidIndex && fs.files[i].nextFile >= i) || fs.files[i].name >= nameCount)
+        return false;
+    }
+    return true;
+  };
+  if (!valid())
+    throw std::runtime_error("Invalid snapshot");
+  for (NodeId i = 1; i < fs.dirs.size(); i++) {
+    if (!fs.childIndex.emplace(Filesystem::childKey(fs.dirs[i].parent, fs.dirs[i].name), i).second)
+      throw std::runtime_error("Invalid snapshot");
+  }
+
+  return snapshot;
+}
+
+// Read only view of a whole file, mapped into memory where supported so huge logs are paged in on demand
+struct MappedFile
+{
+  explicit MappedFile(const std::string& path)
+  {
+#ifdef AOC_HAS_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error("Cannot open " + path);
+    struct stat info{};
+    if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+      size = static_cast<std::size_t>(info.st_size);
+      data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
     }
+    ::close(fd);
+    if (data == MAP_FAILED)
+      throw std::runtime_error("Cannot map " + path);
+    if (data)
+      ::madvise(data, size, MADV_SEQUENTIAL);
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+      throw std::runtime_error("Cannot open " + path);
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+#endif
+  }
 
-    for (auto& d : dir->dirs)
-      stack.push(&d);
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile()
+  {
+#ifdef AOC_HAS_MMAP
+    if (data)
+      ::munmap(data, size);
+#endif
+  }
+
+  std::string_view view() const
+  {
+#ifdef AOC_HAS_MMAP
+    return {static_cast<const char*>(data), size};
+#else
+    return data;
+#endif
+  }
+
+private:
+#ifdef AOC_HAS_MMAP
+  void* data{};
+  std::size_t size{};
+#else
+  std::string data;
+#endif
+};
+
+u64 dirSizeSumWithThreshold(const Filesystem& fs, u64 threshold)
+{
+  u64 sum{};
+  for (const auto& dir : fs.dirs) {
+    if (dir.size < threshold)
+      sum += dir.size;
+  }
+  return sum;
+}
+
+u64 freeSpace(const Filesystem& fs, u64 diskSpace, u64 targetFreeSpace)
+{
+  auto toFree = targetFreeSpace - (diskSpace - fs.dirs[Filesystem::root].size);
+
+  const DirNode* smallest = nullptr;
+  for (const auto& dir : fs.dirs) {
+    if (dir.size >= toFree) {
+      if (!smallest || smallest->size > dir.size)
+        smallest = &dir;
+    }
   }
 
   if (smallest == nullptr)
@@ -175,18 +537,106 @@ u64 freeSpace(const Directory& dir, u64 diskSpace, u64 targetFreeSpace)
   return smallest->size;
 }
 
+// Sorted directory sizes with prefix sums of one snapshot, answers threshold and free space queries in O(log n)
+struct DirSizeIndex
+{
+  std::vector<u64> sizes;
+  // prefixSums[i] is the sum of the i smallest sizes
+  std::vector<u64> prefixSums;
+  u64 usedSpace{};
+
+  explicit DirSizeIndex(const Filesystem& fs) :
+      sizes(fs.dirs | ranges::views::transform(&DirNode::size) | ranges::to<std::vector<u64>>()),
+      prefixSums(fs.dirs.size() + 1), usedSpace(fs.dirs[Filesystem::root].size)
+  {
+    ranges::sort(sizes);
+    for (std::size_t i = 0; i < sizes.size(); i++)
+      prefixSums[i + 1] = prefixSums[i] + sizes[i];
+  }
+
+  // Same as dirSizeSumWithThreshold
+  u64 sumBelow(u64 threshold) const
+  {
+    return prefixSums[ranges::lower_bound(sizes, threshold) - sizes.begin()];
+  }
+
+  std::optional<u64> smallestAtLeast(u64 minSize) const
+  {
+    auto found = ranges::lower_bound(sizes, minSize);
+    if (found == sizes.end())
+      return std::nullopt;
+    return *found;
+  }
+
+  // Same as freeSpace
+  u64 freeSpace(u64 diskSpace, u64 targetFreeSpace) const
+  {
+    auto smallest = smallestAtLeast(targetFreeSpace - (diskSpace - usedSpace));
+    if (!smallest)
+      throw std::runtime_error("No dir large enough?");
+    return *smallest;
+  }
+
+  std::vector<u64> sumBelow(const std::vector<u64>& thresholds) const
+  {
+    return thresholds | ranges::views::transform([this](u64 t) { return sumBelow(t); }) |
+           ranges::to<std::vector<u64>>();
+  }
+
+  std::vector<std::optional<u64>> smallestAtLeast(const std::vector<u64>& minSizes) const
+  {
+    return minSizes | ranges::views::transform([this](u64 m) { return smallestAtLeast(m); }) |
+           ranges::to<std::vector<std::optional<u64>>>();
+  }
+};
+
 #ifndef RUN_TESTS
 #include <fstream>
 
 auto main() -> int
 {
-  auto history = parseHistory(std::fstream("../../src/day7/input.txt"));
-  auto dir = parseFilesystemFromHistory(history);
-  fmt::print("Task1 Result: {}\n", dirSizeSumWithThreshold(dir, 100000));
-  fmt::print("Task2 Result: {}\n", freeSpace(dir, 70000000, 30000000));
+  MappedFile input("../../src/day7/input.txt");
+  DirSizeIndex index(ingestLog(input.view(), DirSizes::Deferred));
+  fmt::print("Task1 Result: {}\n", index.sumBelow(100000));
+  fmt::print("Task2 Result: {}\n", index.freeSpace(70000000, 30000000));
 }
 
 #else
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+// Nested copy of the node tables to keep the expectations readable
+struct File
+{
+  std::string name;
+  u64 size;
+
+  bool operator<=>(const File&) const = default;
+};
+
+struct Directory
+{
+  std::string name;
+  std::vector<Directory> dirs;
+  std::vector<File> files;
+
+  std::size_t size{};
+
+  bool operator==(const Directory&) const = default;
+};
+
+Directory toDirectory(const Filesystem& fs, NodeId id = Filesystem::root)
+{
+  const auto& node = fs.dirs[id];
+  Directory dir{fs.names[node.name], {}, {}, node.size};
+  for (NodeId child = node.firstChild; child != InvalidIndex; child = fs.dirs[child].nextSibling)
+    dir.dirs.push_back(toDirectory(fs, child));
+  for (u32 file = node.firstFile; file != InvalidIndex; file = fs.files[file].nextFile)
+    dir.files.push_back({fs.names[fs.files[file].name], fs.files[file].size});
+  // Children are prepended on insertion
+  ranges::reverse(dir.dirs);
+  ranges::reverse(dir.files);
+  return dir;
+}
 
 TEST_CASE("Parse cd")
 {
@@ -273,7 +723,7 @@ TEST_CASE("cd /")
   std::string input = 1 + R"(
 $ cd /)";
   auto history = parseHistory(std::stringstream(input));
-  auto dir = parseFilesystemFromHistory(history);
+  auto dir = toDirectory(parseFilesystemFromHistory(history));
   REQUIRE(dir == Directory{"/"});
 }
 
@@ -286,7 +736,7 @@ $ cd /
 $ cd test
 )";
   auto history = parseHistory(std::stringstream(input));
-  auto dir = parseFilesystemFromHistory(history);
+  auto dir = toDirectory(parseFilesystemFromHistory(history));
   REQUIRE(dir == Directory{"/", {Directory{"test"}}});
 }
 
@@ -301,7 +751,7 @@ $ cd ..
 $ cd test2
 )";
   auto history = parseHistory(std::stringstream(input));
-  auto dir = parseFilesystemFromHistory(history);
+  auto dir = toDirectory(parseFilesystemFromHistory(history));
   REQUIRE(dir == Directory{"/", {Directory{"test"}, Directory{"test2"}}});
 }
 
@@ -314,7 +764,7 @@ $ cd /
 $ ls
 )";
   auto history = parseHistory(std::stringstream(input));
-  auto dir = parseFilesystemFromHistory(history);
+  auto dir = toDirectory(parseFilesystemFromHistory(history));
   REQUIRE(dir == Directory{"/"});
 }
 
@@ -329,7 +779,7 @@ dir d
 dir e
 )";
   auto history = parseHistory(std::stringstream(input));
-  auto dir = parseFilesystemFromHistory(history);
+  auto dir = toDirectory(parseFilesystemFromHistory(history));
   REQUIRE(dir == Directory{"/", {Directory{"d"}, Directory{"e"}}});
 }
 
@@ -343,7 +793,7 @@ $ ls
 2557 f.lst
 62000 abc.txt)";
   auto history = parseHistory(std::stringstream(input));
-  auto dir = parseFilesystemFromHistory(history, false);
+  auto dir = toDirectory(parseFilesystemFromHistory(history, DirSizes::None));
   REQUIRE(dir == Directory{"/", {}, {File{"f.lst", 2557}, File{"abc.txt", 62000}}});
 }
 
@@ -359,11 +809,78 @@ $ cd a
 10 abc.txt)";
 
   auto history = parseHistory(std::stringstream(input));
-  auto dir = parseFilesystemFromHistory(history);
+  auto dir = toDirectory(parseFilesystemFromHistory(history));
   REQUIRE(dir.size == 24);
   REQUIRE(dir.dirs[0].size == 18);
 }
 
+TEST_CASE("Node table")
+{
+  std::string input = 1 + R"(
+$ cd /
+$ ls
+dir a
+dir b
+$ cd a
+$ ls
+dir c
+$ cd c
+$ ls
+3 x
+$ cd ..
+$ cd ..
+$ cd b
+$ ls
+4 x)";
+
+  auto fs = parseFilesystemFromHistory(parseHistory(std::stringstream(input)));
+  REQUIRE(fs.dirs.size() == 4);
+  REQUIRE(fs.files.size() == 2);
+  // Both files share one interned name
+  REQUIRE(fs.files[0].name == fs.files[1].name);
+
+  auto a = fs.findDir(Filesystem::root, fs.names.intern("a"));
+  auto b = fs.findDir(Filesystem::root, fs.names.intern("b"));
+  auto c = fs.findDir(a, fs.names.intern("c"));
+  REQUIRE(c != InvalidIndex);
+  REQUIRE(fs.findDir(b, fs.names.intern("c")) == InvalidIndex);
+  REQUIRE(fs.dirs[c].parent == a);
+  REQUIRE(fs.dirs[a].parent == Filesystem::root);
+  REQUIRE(fs.dirs[c].size == 3);
+  REQUIRE(fs.dirs[a].size == 3);
+  REQUIRE(fs.dirs[b].size == 4);
+  REQUIRE(fs.dirs[Filesystem::root].size == 7);
+}
+
+TEST_CASE("Deferred dir sizes")
+{
+  std::string input = 1 + R"(
+$ cd /
+$ ls
+2 f.lst
+$ cd a
+$ ls
+4 g
+$ cd b
+$ ls
+8 h
+$ cd ..
+$ cd ..
+$ cd c
+$ ls
+16 i)";
+
+  auto eager = toDirectory(ingestLog(input, DirSizes::Eager));
+  auto deferred = toDirectory(ingestLog(input, DirSizes::Deferred));
+  REQUIRE(eager == deferred);
+  REQUIRE(deferred.size == 30);
+  REQUIRE(deferred.dirs[0].size == 12);
+  REQUIRE(deferred.dirs[0].dirs[0].size == 8);
+  REQUIRE(deferred.dirs[1].size == 16);
+  REQUIRE(toDirectory(parseFilesystemFromHistory(parseHistory(std::stringstream(input)), DirSizes::Deferred)) ==
+          deferred);
+}
+
 TEST_CASE("Sum of size smaller than threshold")
 {
   std::string input = 1 + R"(
@@ -384,8 +901,8 @@ $ ls
 10 qwe.asf)";
 
   auto history = parseHistory(std::stringstream(input));
-  auto dir = parseFilesystemFromHistory(history);
-  REQUIRE(dirSizeSumWithThreshold(dir, 20) == 18 + 10);
+  auto fs = parseFilesystemFromHistory(history);
+  REQUIRE(dirSizeSumWithThreshold(fs, 20) == 18 + 10);
 }
 
 TEST_CASE("Example Task1 and 2")
@@ -416,10 +933,233 @@ $ ls
 7214296 k)";
 
   auto history = parseHistory(std::stringstream(input));
-  auto dir = parseFilesystemFromHistory(history);
-  REQUIRE(dirSizeSumWithThreshold(dir, 100000) == 95437);
+  auto fs = parseFilesystemFromHistory(history);
+  REQUIRE(dirSizeSumWithThreshold(fs, 100000) == 95437);
+
+  REQUIRE(freeSpace(fs, 70000000, 30000000) == 24933642);
+}
+
+TEST_CASE("cd .. at the root")
+{
+  REQUIRE(toDirectory(ingestLog("$ cd /\n$ cd ..\n$ cd ..\n$ ls\n5 a\n")) == Directory{"/", {}, {File{"a", 5}}, 5});
+  auto history = parseHistory(std::stringstream("$ cd /\n$ cd ..\n$ ls\n5 a\n"));
+  REQUIRE(toDirectory(parseFilesystemFromHistory(history)) == Directory{"/", {}, {File{"a", 5}}, 5});
+}
 
-  REQUIRE(freeSpace(dir, 70000000, 30000000) == 24933642);
+TEST_CASE("Streaming ingestion")
+{
+  std::string input = 1 + R"(
+$ cd /
+$ ls
+dir a
+14848514 b.txt
+8504156 c.dat
+dir d
+$ cd a
+$ ls
+dir e
+29116 f
+2557 g
+62596 h.lst
+$ cd e
+$ ls
+584 i
+$ cd ..
+$ cd ..
+$ cd d
+$ ls
+4060174 j
+8033020 d.log
+5626152 d.ext
+7214296 k
+)";
+
+  auto fs = ingestLog(input);
+  REQUIRE(toDirectory(fs) == toDirectory(parseFilesystemFromHistory(parseHistory(std::stringstream(input)))));
+  REQUIRE(dirSizeSumWithThreshold(fs, 100000) == 95437);
+  REQUIRE(freeSpace(fs, 70000000, 30000000) == 24933642);
+
+  REQUIRE(toDirectory(ingestLog("$ cd /\r\n$ ls\r\n5 a\r\n")) == Directory{"/", {}, {File{"a", 5}}, 5});
+  REQUIRE_THROWS(ingestLog("$ ls\n"));
+
+  SECTION("Mapped file")
+  {
+    MappedFile file("../../src/day7/input.txt");
+    REQUIRE(toDirectory(ingestLog(file.view())) ==
+            toDirectory(parseFilesystemFromHistory(parseHistory(std::fstream("../../src/day7/input.txt")))));
+  }
+}
+
+TEST_CASE("Incremental snapshots")
+{
+  std::string log = MappedFile("../../src/day7/input.txt").view() | ranges::to<std::string>();
+  auto full = toDirectory(ingestLog(log));
+
+  // Replays the log in growing chunks, going through a saved snapshot in between
+  FilesystemSnapshot snapshot;
+  for (auto start : {""sv, "$ cd"sv, "$ cd /"sv}) {
+    ingestLogTail(snapshot, start);
+    REQUIRE(snapshot.logOffset == 0);
+  }
+  FilesystemSnapshot invalid;
+  REQUIRE_THROWS(ingestLogTail(invalid, "$ ls\n"));
+  for (std::size_t end = 0; end < log.size();) {
+    end = std::min(log.size(), end + 997);
+    ingestLogTail(snapshot, std::string_view(log).substr(0, end));
+    REQUIRE(snapshot.logOffset <= end);
+
+    std::stringstream stored;
+    saveSnapshot(snapshot, std::move(stored));
+    snapshot = loadSnapshot(std::move(stored));
+  }
+
+  REQUIRE(snapshot.logOffset == log.size());
+  REQUIRE(toDirectory(snapshot.fs) == full);
+
+  // A line that is still being written stays for the next refresh
+  ingestLogTail(snapshot, log + "$ cd /\n123 new_fi");
+  REQUIRE(snapshot.logOffset == log.size() + 7);
+  ingestLogTail(snapshot, log + "$ cd /\n123 new_file\n");
+  REQUIRE(snapshot.fs.dirs[Filesystem::root].size == full.size + 123);
+
+  // An invalid line keeps the lines before it and stays at the start of the log tail
+  auto dirCount = snapshot.fs.dirs.size();
+  auto validTail = log + "$ cd /\n123 new_file\n$ ls\n7 other_file\n";
+  REQUIRE_THROWS(ingestLogTail(snapshot, validTail + "garbage line\n"));
+  REQUIRE(snapshot.logOffset == validTail.size());
+  REQUIRE(snapshot.fs.dirs.size() == dirCount);
+  REQUIRE(snapshot.cwd == Filesystem::root);
+  REQUIRE(snapshot.fs.dirs[Filesystem::root].size == full.size + 130);
+  ingestLogTail(snapshot, validTail + "1 fixed_line\n");
+  REQUIRE(snapshot.fs.dirs[Filesystem::root].size == full.size + 131);
+
+  REQUIRE_THROWS(ingestLogTail(snapshot, "$ cd /\n"));
+  REQUIRE_THROWS(loadSnapshot(std::stringstream("garbage")));
+
+  // Well framed but corrupted node tables
+  auto corrupted = [&](auto corrupt) {
+    auto copy = snapshot;
+    corrupt(copy.fs);
+    std::stringstream stored;
+    saveSnapshot(copy, std::move(stored));
+    return stored;
+  };
+  REQUIRE_NOTHROW(loadSnapshot(corrupted([](Filesystem&) {})));
+  REQUIRE_THROWS(loadSnapshot(corrupted([](Filesystem& fs) { fs.dirs[1].parent = 1; })));
+  REQUIRE_THROWS(loadSnapshot(corrupted([](Filesystem& fs) { fs.dirs[0].firstChild = 1'000'000; })));
+  REQUIRE_THROWS(loadSnapshot(corrupted([](Filesystem& fs) { fs.dirs.back().nextSibling = 0; })));
+  REQUIRE_THROWS(loadSnapshot(corrupted([](Filesystem& fs) { fs.dirs[0].firstFile = 1'000'000; })));
+  REQUIRE_THROWS(loadSnapshot(corrupted([](Filesystem& fs) { fs.files[0].nextFile = 0; })));
+  REQUIRE_THROWS(loadSnapshot(corrupted([](Filesystem& fs) { fs.files.back().name = 1'000'000; })));
+  REQUIRE_THROWS(loadSnapshot(corrupted([](Filesystem& fs) { fs.dirs.back().name = 1'000'000; })));
+  REQUIRE_THROWS(loadSnapshot(corrupted([](Filesystem& fs) { fs.names.names.push_back(fs.names.names[0]); })));
+}
+
+TEST_CASE("Dir size index")
+{
+  auto fs = ingestLog(MappedFile("../../src/day7/input.txt").view(), DirSizes::Deferred);
+  DirSizeIndex index(fs);
+
+  REQUIRE(index.sizes.size() == fs.dirs.size());
+  REQUIRE(index.usedSpace == fs.dirs[Filesystem::root].size);
+
+  std::vector<u64> thresholds{0, 1, 100000, 1000000, index.sizes[10], index.usedSpace, index.usedSpace + 1};
+  auto sums = index.sumBelow(thresholds);
+  for (std::size_t i = 0; i < thresholds.size(); i++) {
+    REQUIRE(sums[i] == dirSizeSumWithThreshold(fs, thresholds[i]));
+  }
+
+  auto smallest = index.smallestAtLeast({0, index.sizes[10], index.sizes[10] + 1, index.usedSpace + 1});
+  REQUIRE(smallest[0] == index.sizes[0]);
+  REQUIRE(smallest[1] == index.sizes[10]);
+  REQUIRE(smallest[2] > index.sizes[10]);
+  REQUIRE(!smallest[3]);
+
+  REQUIRE(index.freeSpace(70000000, 30000000) == freeSpace(fs, 70000000, 30000000));
+  REQUIRE_THROWS(index.freeSpace(index.usedSpace, index.usedSpace + 1));
+}
+
+TEST_CASE("Dir size index benchmark", "[.][benchmark]")
+{
+  DirSizeIndex index(ingestLog(MappedFile("../../src/day7/input.txt").view(), DirSizes::Deferred));
+  std::vector<u64> manyThresholds = ranges::views::iota(0u, 100000u) |
+                                    ranges::views::transform([](u64 i) { return i * 100; }) |
+                                    ranges::to<std::vector<u64>>();
+  BENCHMARK("100k threshold queries")
+  {
+    return index.sumBelow(manyThresholds);
+  };
+}
+
+// Descends one level per directory and puts a file into every level
+std::string deepDirectoriesLog(u32 depth)
+{
+  std::string input = "$ cd /\n";
+  for (u32 i = 0; i < depth; i++)
+    input += "$ cd d\n$ ls\n1 f\n";
+  return input;
+}
+
+TEST_CASE("Deep directories")
+{
+  constexpr u32 depth = 5000;
+  std::string input = deepDirectoriesLog(depth);
+
+  auto deferred = ingestLog(input, DirSizes::Deferred);
+  REQUIRE(deferred.dirs[Filesystem::root].size == depth);
+  REQUIRE(deferred.dirs.back().size == 1);
+  REQUIRE(toDirectory(ingestLog(input, DirSizes::Eager)) == toDirectory(deferred));
+}
+
+TEST_CASE("Deep directories benchmark", "[.][benchmark]")
+{
+  std::string input = deepDirectoriesLog(5000);
+
+  BENCHMARK("Eager sizes 5k levels")
+  {
+    return ingestLog(input, DirSizes::Eager);
+  };
+
+  BENCHMARK("Deferred sizes 5k levels")
+  {
+    return ingestLog(input, DirSizes::Deferred);
+  };
+}
+
+// Lists all children and then enters every one of them
+std::string wideDirectoriesLog(u32 children)
+{
+  std::string input = "$ cd /\n$ ls\n";
+  for (u32 i = 0; i < children; i++)
+    input += fmt::format("dir d{}\n", i);
+  for (u32 i = 0; i < children; i++)
+    input += fmt::format("$ cd d{}\n$ ls\n{} f\n$ cd ..\n", i, i);
+  return input;
+}
+
+TEST_CASE("Wide directories")
+{
+  constexpr u32 children = 100000;
+  auto fs = parseFilesystemFromHistory(parseHistory(std::stringstream(wideDirectoriesLog(children))));
+  REQUIRE(fs.dirs.size() == children + 1);
+  REQUIRE(fs.dirs[fs.findDir(Filesystem::root, fs.names.intern("d1234"))].size == 1234);
+  REQUIRE(fs.dirs[Filesystem::root].size == u64{children} * (children - 1) / 2);
+}
+
+TEST_CASE("Wide directories benchmark", "[.][benchmark]")
+{
+  std::string input = wideDirectoriesLog(100000);
+  auto history = parseHistory(std::stringstream(input));
+
+  BENCHMARK("Parse 100k children")
+  {
+    return parseFilesystemFromHistory(history);
+  };
+
+  BENCHMARK("Stream 100k children")
+  {
+    return ingestLog(input);
+  };
 }
 
 #endif
@@ -1,60 +1,111 @@
 #include <common.hpp>
 
+#include <random>
+
 #define RUN_TESTS
 
-using Wood = std::vector<std::vector<u32>>;
+using Wood = Grid<u8>;
 
 Wood parseWood(std::istream&& input)
 {
-  // using namespace ranges;
-  using namespace ranges::views;
-  using ranges::getlines;
-  using ranges::to;
-  return getlines(input) |
-         transform([](auto& view) { return view | transform([](char c) { return c - '0'; }) | to<std::vector<u32>>; }) |
-         to<std::vector<std::vector<u32>>>;
+  std::vector<u8> heights;
+  std::size_t width{};
+  std::size_t height{};
+  for (std::string_view line : ranges::getlines(input)) {
+    if (line.ends_with('\r'))
+      line.remove_suffix(1);
+    width = line.size();
+    height++;
+    // Heights index the blocker tables, so anything but a digit is rejected here
+    for (char c : line) {
+      if (c < '0' || c > '9')
+        throw std::runtime_error("Invalid tree height");
+      heights.push_back(static_cast<u8>(c - '0'));
+    }
+  }
+  return {width, height, std::move(heights)};
 }
 
-bool isTreeVisible(const Wood wood, std::size_t x, std::size_t y)
+bool isTreeVisible(const Wood& wood, std::size_t x, std::size_t y)
 {
   using namespace ranges;
-  auto view_left = wood[y] | views::take(x);
-  auto view_right = wood[y] | views::drop(x + 1);
+  auto row = wood.row(y);
+  auto view_left = row | views::take(x);
+  auto view_right = row | views::drop(x + 1);
 
-  auto view_topdown = wood | views::transform([x](const auto& view) { return view[x]; });
+  auto view_topdown = wood.column(x);
   auto view_top = view_topdown | views::take(y);
   auto view_bottom = view_topdown | views::drop(y + 1);
 
-  auto isSmaller = [compare = wood[y][x]](u32 h) { return h < compare; };
+  auto isSmaller = [compare = wood(x, y)](u8 h) { return h < compare; };
 
   return ranges::all_of(view_left, isSmaller) || ranges::all_of(view_right, isSmaller) ||
          ranges::all_of(view_top, isSmaller) || ranges::all_of(view_bottom, isSmaller);
 }
 
+// Map with 1 for every tree visible from outside. Built with four running max sweeps, each one looks at every tree
+// once. The top and bottom sweeps keep one running max per column and go row by row, so all sweeps read the rows front
+// to back and the column sweeps vectorize over whole rows of bytes.
+Grid<u8> visibilityMap(const Wood& wood)
+{
+  Grid<u8> visible(wood.width, wood.height);
+
+  // Running maxima store height + 1, so 0 means no tree yet and everything fits in a byte
+  for (std::size_t y = 0; y < wood.height; y++) {
+    auto row = wood.row(y);
+    auto visibleRow = visible.row(y);
+
+    u8 leftMax = 0;
+    for (std::size_t x = 0; x < wood.width; x++) {
+      visibleRow[x] |= row[x] >= leftMax;
+      leftMax = std::max<u8>(leftMax, row[x] + 1);
+    }
+
+    u8 rightMax = 0;
+    for (std::size_t x = wood.width; x-- > 0;) {
+      visibleRow[x] |= row[x] >= rightMax;
+      rightMax = std::max<u8>(rightMax, row[x] + 1);
+    }
+  }
+
+  std::vector<u8> columnMax(wood.width);
+  auto sweepRow = [&](std::size_t y) {
+    auto row = wood.row(y);
+    auto visibleRow = visible.row(y);
+    for (std::size_t x = 0; x < wood.width; x++) {
+      visibleRow[x] |= row[x] >= columnMax[x];
+      columnMax[x] = std::max<u8>(columnMax[x], row[x] + 1);
+    }
+  };
+
+  for (std::size_t y = 0; y < wood.height; y++)
+    sweepRow(y);
+
+  ranges::fill(columnMax, 0);
+  for (std::size_t y = wood.height; y-- > 0;)
+    sweepRow(y);
+
+  return visible;
+}
+
 u64 countVisibleTrees(const Wood& wood)
 {
-  using namespace ranges::views;
-  return ranges::accumulate(iota(0u, wood.size()) | transform([&wood](const auto& row_index) {
-                              return ranges::count_if(iota(0u, wood[row_index].size()),
-                                                      [&wood, row_index](auto col_index) {
-                                                        return isTreeVisible(wood, col_index, row_index);
-                                                      });
-                            }),
-                            0u);
+  return static_cast<u64>(ranges::count(visibilityMap(wood).data, u8{1}));
 }
 
-std::array<u64, 4> visibleTreesInAllDirections(const Wood wood, std::size_t x, std::size_t y)
+std::array<u64, 4> visibleTreesInAllDirections(const Wood& wood, std::size_t x, std::size_t y)
 {
   using namespace ranges;
-  auto view_left = wood[y] | views::take(x) | views::reverse;
-  auto view_right = wood[y] | views::drop(x + 1);
+  auto row = wood.row(y);
+  auto view_left = row | views::take(x) | views::reverse;
+  auto view_right = row | views::drop(x + 1);
 
-  auto view_topdown = wood | views::transform([x](const auto& view) { return view[x]; });
+  auto view_topdown = wood.column(x);
   auto view_top = view_topdown | views::take(y) | views::reverse;
   auto view_bottom = view_topdown | views::drop(y + 1);
 
-  auto count_visible_trees = [height = wood[y][x]](auto& view) {
-    return static_cast<u64>(ranges::count_if(view, [height, blocked = false](u32 h) mutable {
+  auto count_visible_trees = [height = wood(x, y)](auto& view) {
+    return static_cast<u64>(ranges::count_if(view, [height, blocked = false](u8 h) mutable {
       if (!blocked && h >= height) {
         blocked = true;
         return true;
@@ -71,15 +122,220 @@ u64 scenicScore(std::array<u64, 4> values)
   return ranges::accumulate(values, 1u, std::multiplies<u64>());
 }
 
+// Index of the closest tree of at least a given height, heights are digits so a table of 10 entries is enough
+using BlockerTable = std::array<u32, 10>;
+
+// Looks at the closest blocker in the table and afterwards adds the tree itself
+template <typename Distance>
+u64 viewingDistance(BlockerTable& blockers, u8 h, u32 index, Distance distance)
+{
+  u64 result = distance(blockers[h], index);
+  for (u32 i = 0; i <= h; i++)
+    blockers[i] = index;
+  return result;
+}
+
+constexpr auto towardsStart = [](u32 blocker, u32 index) { return index - blocker; };
+constexpr auto towardsEnd = [](u32 blocker, u32 index) { return blocker - index; };
+
+// Scenic score of every tree. One sweep per direction with a blocker table, which makes it linear in the number of
+// trees. Like visibilityMap the top and bottom sweeps keep a table per column and go row by row.
+Grid<u64> scenicScoreMap(const Wood& wood)
+{
+  const auto height = static_cast<u32>(wood.height);
+  const auto width = static_cast<u32>(wood.width);
+  Grid<u64> scores(width, height, 1);
+
+  for (u32 y = 0; y < height; y++) {
+    auto row = wood.row(y);
+    auto scoreRow = scores.row(y);
+
+    BlockerTable left{};
+    for (u32 x = 0; x < width; x++)
+      scoreRow[x] *= viewingDistance(left, row[x], x, towardsStart);
+
+    BlockerTable right;
+    right.fill(width - 1);
+    for (u32 x = width; x-- > 0;)
+      scoreRow[x] *= viewingDistance(right, row[x], x, towardsEnd);
+  }
+
+  std::vector<BlockerTable> columns(width);
+  auto sweepRow = [&](u32 y, auto distance) {
+    auto row = wood.row(y);
+    auto scoreRow = scores.row(y);
+    for (u32 x = 0; x < width; x++)
+      scoreRow[x] *= viewingDistance(columns[x], row[x], y, distance);
+  };
+
+  for (u32 y = 0; y < height; y++)
+    sweepRow(y, towardsStart);
+
+  for (auto& column : columns)
+    column.fill(height - 1);
+  for (u32 y = height; y-- > 0;)
+    sweepRow(y, towardsEnd);
+
+  return scores;
+}
+
 u64 findHighestScenicScore(const Wood& wood)
 {
-  using namespace ranges::views;
-  return ranges::max(iota(1u, wood.size() - 1) | transform([&wood](const auto& row_index) {
-                       return ranges::max(iota(1u, wood[row_index].size() - 1) |
-                                          transform([&wood, row_index](auto col_index) {
-                                            return scenicScore(visibleTreesInAllDirections(wood, col_index, row_index));
-                                          }));
-                     }));
+  return ranges::max(scenicScoreMap(wood).data);
+}
+
+struct WoodSummary
+{
+  u64 visibleTrees{};
+  u64 highestScenicScore{};
+
+  bool operator==(const WoodSummary&) const = default;
+};
+
+// Columns one thread sweeps together, the per column state of a tile stays in L1
+constexpr std::size_t ColumnTileWidth = 256;
+// Rows one thread analyzes together, only a band needs per tree buffers
+constexpr std::size_t RowBandHeight = 256;
+
+// What the top or bottom sweep knows about a column
+struct ColumnSweepState
+{
+  u8 max{};
+  BlockerTable blockers{};
+};
+
+// Advances a top or bottom sweep by one tree, returns if the tree is visible from that side and its viewing distance
+template <typename Distance>
+std::pair<bool, u32> sweepColumn(ColumnSweepState& column, u8 h, u32 y, Distance distance)
+{
+  bool visible = h >= column.max;
+  column.max = std::max<u8>(column.max, h + 1);
+  return {visible, static_cast<u32>(viewingDistance(column.blockers, h, y, distance))};
+}
+
+// Same as countVisibleTrees and findHighestScenicScore in one go on multiple threads. A first pass sweeps tiles of
+// adjacent columns from the top and the bottom and only keeps the state of both sweeps at every band border. The second
+// pass splits bands of rows between the threads: the left and right sweeps run over the rows of a band, the top and
+// bottom sweeps are resumed at its borders. Besides the saved states only one band per thread is buffered.
+WoodSummary analyzeWood(const Wood& wood, std::size_t threadCount = std::thread::hardware_concurrency())
+{
+  // left + right < width, so their product fits into 32 bits
+  if (wood.width > 131072)
+    return {countVisibleTrees(wood), findHighestScenicScore(wood)};
+
+  const auto width = static_cast<u32>(wood.width);
+  const auto height = static_cast<u32>(wood.height);
+  const std::size_t tileCount = (wood.width + ColumnTileWidth - 1) / ColumnTileWidth;
+  const std::size_t bandCount = (wood.height + RowBandHeight - 1) / RowBandHeight;
+  auto tileBegin = [&](std::size_t tile) { return static_cast<u32>(std::min(tile * ColumnTileWidth, wood.width)); };
+  auto bandBegin = [&](std::size_t band) { return static_cast<u32>(std::min(band * RowBandHeight, wood.height)); };
+
+  // State of the top sweep before the first row of every band and of the bottom sweep before the last row
+  Grid<ColumnSweepState> fromTop(width, bandCount);
+  Grid<ColumnSweepState> fromBottom(width, bandCount);
+  ColumnSweepState bottom;
+  bottom.blockers.fill(height - 1);
+
+  parallelFor(tileCount, threadCount, [&](std::size_t begin, std::size_t end) {
+    std::vector<ColumnSweepState> columns;
+    for (std::size_t tile = begin; tile < end; tile++) {
+      const auto x0 = tileBegin(tile);
+      const auto tileWidth = tileBegin(tile + 1) - x0;
+
+      columns.assign(tileWidth, {});
+      for (u32 y = 0; y < height; y++) {
+        if (y % RowBandHeight == 0)
+          std::copy(columns.begin(), columns.end(), fromTop.row(y / RowBandHeight).begin() + x0);
+        auto row = wood.row(y).subspan(x0, tileWidth);
+        for (u32 i = 0; i < tileWidth; i++)
+          sweepColumn(columns[i], row[i], y, towardsStart);
+      }
+
+      columns.assign(tileWidth, bottom);
+      for (u32 y = height; y-- > 0;) {
+        if (y + 1 == height || (y + 1) % RowBandHeight == 0)
+          std::copy(columns.begin(), columns.end(), fromBottom.row(y / RowBandHeight).begin() + x0);
+        auto row = wood.row(y).subspan(x0, tileWidth);
+        for (u32 i = 0; i < tileWidth; i++)
+          sweepColumn(columns[i], row[i], y, towardsEnd);
+      }
+    }
+  });
+
+  std::vector<WoodSummary> bandResults(bandCount);
+  parallelFor(bandCount, threadCount, [&](std::size_t begin, std::size_t end) {
+    std::vector<u8> visible;
+    std::vector<u32> rowScores;
+    std::vector<u32> down;
+    std::vector<ColumnSweepState> columns;
+
+    for (std::size_t band = begin; band < end; band++) {
+      const auto y0 = bandBegin(band);
+      const auto y1 = bandBegin(band + 1);
+      auto& result = bandResults[band];
+      visible.assign(std::size_t{y1 - y0} * width, 0);
+      rowScores.resize(std::size_t{y1 - y0} * width);
+      auto bandIndex = [&](u32 x, u32 y) { return std::size_t{y - y0} * width + x; };
+
+      for (u32 y = y0; y < y1; y++) {
+        auto row = wood.row(y);
+        auto visibleRow = std::span(visible).subspan(bandIndex(0, y), width);
+        auto scoreRow = std::span(rowScores).subspan(bandIndex(0, y), width);
+
+        u8 leftMax = 0;
+        BlockerTable left{};
+        for (u32 x = 0; x < width; x++) {
+          visibleRow[x] |= row[x] >= leftMax;
+          leftMax = std::max<u8>(leftMax, row[x] + 1);
+          scoreRow[x] = static_cast<u32>(viewingDistance(left, row[x], x, towardsStart));
+        }
+
+        u8 rightMax = 0;
+        BlockerTable right;
+        right.fill(width - 1);
+        for (u32 x = width; x-- > 0;) {
+          visibleRow[x] |= row[x] >= rightMax;
+          rightMax = std::max<u8>(rightMax, row[x] + 1);
+          scoreRow[x] *= static_cast<u32>(viewingDistance(right, row[x], x, towardsEnd));
+        }
+      }
+
+      for (std::size_t tile = 0; tile < tileCount; tile++) {
+        const auto x0 = tileBegin(tile);
+        const auto tileWidth = tileBegin(tile + 1) - x0;
+        down.resize(std::size_t{y1 - y0} * tileWidth);
+
+        auto saved = fromBottom.row(band).subspan(x0, tileWidth);
+        columns.assign(saved.begin(), saved.end());
+        for (u32 y = y1; y-- > y0;) {
+          auto row = wood.row(y).subspan(x0, tileWidth);
+          for (u32 i = 0; i < tileWidth; i++) {
+            auto [fromBelow, distance] = sweepColumn(columns[i], row[i], y, towardsEnd);
+            visible[bandIndex(x0 + i, y)] |= fromBelow;
+            down[std::size_t{y - y0} * tileWidth + i] = distance;
+          }
+        }
+
+        saved = fromTop.row(band).subspan(x0, tileWidth);
+        columns.assign(saved.begin(), saved.end());
+        for (u32 y = y0; y < y1; y++) {
+          auto row = wood.row(y).subspan(x0, tileWidth);
+          for (u32 i = 0; i < tileWidth; i++) {
+            auto [fromAbove, up] = sweepColumn(columns[i], row[i], y, towardsStart);
+            auto index = bandIndex(x0 + i, y);
+            result.visibleTrees += visible[index] | fromAbove;
+
+            u64 score = u64{rowScores[index]} * up * down[std::size_t{y - y0} * tileWidth + i];
+            result.highestScenicScore = std::max(result.highestScenicScore, score);
+          }
+        }
+      }
+    }
+  });
+
+  return ranges::accumulate(bandResults, WoodSummary{}, [](WoodSummary sum, const WoodSummary& band) {
+    return WoodSummary{sum.visibleTrees + band.visibleTrees, std::max(sum.highestScenicScore, band.highestScenicScore)};
+  });
 }
 
 #ifndef RUN_TESTS
@@ -88,11 +344,22 @@ u64 findHighestScenicScore(const Wood& wood)
 auto main() -> int
 {
   auto wood = parseWood(std::fstream("../../src/day8/input.txt"));
-  fmt::print("Task1 Result: {}\n", countVisibleTrees(wood));
-  fmt::print("Task2 Result: {}\n", findHighestScenicScore(wood));
+  auto summary = analyzeWood(wood);
+  fmt::print("Task1 Result: {}\n", summary.visibleTrees);
+  fmt::print("Task2 Result: {}\n", summary.highestScenicScore);
 }
 
 #else
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+Wood randomWood(std::size_t width, std::size_t height)
+{
+  std::mt19937 rng(width * height);
+  std::uniform_int_distribution<u32> digit(0, 9);
+  Wood wood(width, height);
+  ranges::generate(wood.data, [&] { return static_cast<u8>(digit(rng)); });
+  return wood;
+}
 
 TEST_CASE("Task1 wood")
 {
@@ -107,15 +374,23 @@ TEST_CASE("Task1 wood")
 
   SECTION("Parsing")
   {
-    REQUIRE(wood.size() == 5);
-    for (const auto& line : wood)
-      REQUIRE(line.size() == 5);
-
-    REQUIRE(wood[0] == std::vector<u32>{3, 0, 3, 7, 3});
-    REQUIRE(wood[1] == std::vector<u32>{2, 5, 5, 1, 2});
-    REQUIRE(wood[2] == std::vector<u32>{6, 5, 3, 3, 2});
-    REQUIRE(wood[3] == std::vector<u32>{3, 3, 5, 4, 9});
-    REQUIRE(wood[4] == std::vector<u32>{3, 5, 3, 9, 0});
+    REQUIRE(wood.height == 5);
+    REQUIRE(wood.width == 5);
+
+    REQUIRE(ranges::equal(wood.row(0), std::vector<u8>{3, 0, 3, 7, 3}));
+    REQUIRE(ranges::equal(wood.row(1), std::vector<u8>{2, 5, 5, 1, 2}));
+    REQUIRE(ranges::equal(wood.row(2), std::vector<u8>{6, 5, 3, 3, 2}));
+    REQUIRE(ranges::equal(wood.row(3), std::vector<u8>{3, 3, 5, 4, 9}));
+    REQUIRE(ranges::equal(wood.row(4), std::vector<u8>{3, 5, 3, 9, 0}));
+    REQUIRE(ranges::equal(wood.column(3), std::vector<u8>{7, 1, 3, 4, 9}));
+
+    std::string crlf;
+    for (char c : input)
+      crlf += c == '\n' ? "\r\n"s : std::string(1, c);
+    REQUIRE(parseWood(std::stringstream(crlf)) == wood);
+    REQUIRE(findHighestScenicScore(parseWood(std::stringstream(crlf))) == 8);
+    REQUIRE_THROWS(parseWood(std::stringstream("303a3\n25512")));
+    REQUIRE_THROWS(parseWood(std::stringstream("30373\n255 2")));
   }
 
   SECTION("Visible")
@@ -160,4 +435,121 @@ TEST_CASE("Task1 wood")
   }
 }
 
+TEST_CASE("Grid")
+{
+  Grid<u8> grid(3, 2, std::vector<u8>{1, 2, 3, 4, 5, 6});
+  REQUIRE(grid(2, 1) == 6);
+  REQUIRE(ranges::equal(grid.row(1), std::vector<u8>{4, 5, 6}));
+  REQUIRE(ranges::equal(grid.column(1), std::vector<u8>{2, 5}));
+
+  auto transposed = grid.transposed();
+  REQUIRE(transposed.width == 2);
+  REQUIRE(transposed.height == 3);
+  REQUIRE(transposed.data == std::vector<u8>{1, 4, 2, 5, 3, 6});
+  REQUIRE(transposed.transposed() == grid);
+
+  grid.column(0)[1] = 9;
+  REQUIRE(grid(0, 1) == 9);
+  REQUIRE_THROWS(Grid<u8>(2, 2, std::vector<u8>{1}));
+}
+
+TEST_CASE("Visibility map")
+{
+  for (auto [width, height] : {std::pair{1, 1}, {7, 3}, {3, 7}, {40, 40}}) {
+    Wood wood = randomWood(width, height);
+    auto visible = visibilityMap(wood);
+    for (std::size_t y = 0; y < wood.height; y++) {
+      for (std::size_t x = 0; x < wood.width; x++) {
+        REQUIRE(static_cast<bool>(visible(x, y)) == isTreeVisible(wood, x, y));
+      }
+    }
+  }
+}
+
+TEST_CASE("Visibility benchmark", "[.][benchmark]")
+{
+  Wood small = randomWood(300, 300);
+  auto countPerTree = [&small] {
+    return static_cast<u64>(ranges::count_if(ranges::views::iota(0u, 300u * 300u),
+                                             [&small](u32 i) { return isTreeVisible(small, i % 300, i / 300); }));
+  };
+  REQUIRE(countVisibleTrees(small) == countPerTree());
+
+  BENCHMARK("Per tree scan 300x300")
+  {
+    return countPerTree();
+  };
+  BENCHMARK("Sweeps 300x300")
+  {
+    return countVisibleTrees(small);
+  };
+
+  Wood large = randomWood(10000, 10000);
+  BENCHMARK("Sweeps 10000x10000")
+  {
+    return countVisibleTrees(large);
+  };
+}
+
+TEST_CASE("Scenic score map")
+{
+  for (auto [width, height] : {std::pair{1, 1}, {7, 3}, {3, 7}, {40, 40}}) {
+    Wood wood = randomWood(width, height);
+    auto scores = scenicScoreMap(wood);
+    for (std::size_t y = 0; y < wood.height; y++) {
+      for (std::size_t x = 0; x < wood.width; x++) {
+        REQUIRE(scores(x, y) == scenicScore(visibleTreesInAllDirections(wood, x, y)));
+      }
+    }
+  }
+}
+
+TEST_CASE("Scenic score benchmark", "[.][benchmark]")
+{
+  Wood small = randomWood(300, 300);
+  BENCHMARK("Per tree walk 300x300")
+  {
+    u64 best{};
+    for (std::size_t y = 0; y < small.height; y++) {
+      for (std::size_t x = 0; x < small.width; x++)
+        best = std::max(best, scenicScore(visibleTreesInAllDirections(small, x, y)));
+    }
+    return best;
+  };
+  BENCHMARK("Blocker tables 300x300")
+  {
+    return findHighestScenicScore(small);
+  };
+
+  Wood large = randomWood(10000, 10000);
+  BENCHMARK("Blocker tables 10000x10000")
+  {
+    return findHighestScenicScore(large);
+  };
+}
+
+TEST_CASE("Parallel wood analysis")
+{
+  for (auto [width, height] :
+       {std::pair{1, 1}, {7, 3}, {3, 700}, {600, 40}, {513, 257}, {40, 1024}, {300, 513}, {140000, 2}}) {
+    Wood wood = randomWood(width, height);
+    WoodSummary expected{countVisibleTrees(wood), findHighestScenicScore(wood)};
+    for (std::size_t threads : {1, 2, 3, 8})
+      REQUIRE(analyzeWood(wood, threads) == expected);
+  }
+}
+
+TEST_CASE("Parallel benchmark", "[.][benchmark]")
+{
+  Wood large = randomWood(10000, 10000);
+  BENCHMARK("Single threaded sweeps 10000x10000")
+  {
+    return WoodSummary{countVisibleTrees(large), findHighestScenicScore(large)};
+  };
+  BENCHMARK("Parallel sweeps 10000x10000")
+  {
+    return analyzeWood(large);
+  };
+}
+
 #endif
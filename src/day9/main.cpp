@@ -1,5 +1,7 @@
 #include <common.hpp>
 
+#include <bit>
+#include <random>
 #include <set>
 
 // #define RUN_TESTS
@@ -57,15 +59,134 @@ struct Pos
   bool operator==(const Pos& o) const = default;
 };
 
+// Open addressing hash set of positions, each one packed into a single 64 bit key
+struct PositionSet
+{
+  PositionSet() :
+      slots(16, EmptyKey)
+  {
+  }
+
+  // Returns true if the position was not in the set yet
+  bool insert(Pos pos)
+  {
+    u64 key = pack(pos);
+    if (key == EmptyKey) {
+      bool inserted = !containsEmptyKey;
+      containsEmptyKey = true;
+      return inserted;
+    }
+
+    if ((count + 1) * 2 > slots.size())
+      grow();
+    if (insertKey(key)) {
+      count++;
+      return true;
+    }
+    return false;
+  }
+
+  bool contains(Pos pos) const
+  {
+    u64 key = pack(pos);
+    if (key == EmptyKey)
+      return containsEmptyKey;
+
+    for (std::size_t i = slotIndex(key);; i = (i + 1) & (slots.size() - 1)) {
+      if (slots[i] == key)
+        return true;
+      if (slots[i] == EmptyKey)
+        return false;
+    }
+  }
+
+  // Inserts the straight line start + step, start + 2 * step, ... of length count
+  void insertRun(Pos start, Pos step, i32 count)
+  {
+    for (i32 i = 1; i <= count; i++)
+      insert({start.x + step.x * i, start.y + step.y * i});
+  }
+
+  std::size_t size() const
+  {
+    return count + (containsEmptyKey ? 1 : 0);
+  }
+
+private:
+  // The position (INT32_MIN, INT32_MIN) marks free slots, it is tracked on the side instead
+  static constexpr u64 EmptyKey = 0x8000'0000'8000'0000;
+
+  std::vector<u64> slots;
+  std::size_t count{};
+  bool containsEmptyKey{};
+
+  static u64 pack(Pos pos)
+  {
+    return (static_cast<u64>(static_cast<u32>(pos.x)) << 32) | static_cast<u32>(pos.y);
+  }
+
+  std::size_t slotIndex(u64 key) const
+  {
+    // Fibonacci hashing spreads neighboring positions over the whole table
+    return static_cast<std::size_t>((key * 0x9E37'79B9'7F4A'7C15) >> (64 - std::countr_zero(slots.size())));
+  }
+
+  bool insertKey(u64 key)
+  {
+    for (std::size_t i = slotIndex(key);; i = (i + 1) & (slots.size() - 1)) {
+      if (slots[i] == key)
+        return false;
+      if (slots[i] == EmptyKey) {
+        slots[i] = key;
+        return true;
+      }
+    }
+  }
+
+  void grow()
+  {
+    std::vector<u64> old(slots.size() * 2, EmptyKey);
+    std::swap(old, slots);
+    for (u64 key : old) {
+      if (key != EmptyKey)
+        insertKey(key);
+    }
+  }
+};
+
 struct Rope
 {
+  static constexpr u32 NotTracked = std::numeric_limits<u32>::max();
+
   Rope(std::size_t numberOfKnots, std::size_t knotIndexToTrack) :
-      knots(numberOfKnots), knotIndexToTrack(knotIndexToTrack)
+      Rope(numberOfKnots, std::vector<std::size_t>{knotIndexToTrack})
+  {
+  }
+
+  // Tracks the unique positions of several knots at once
+  Rope(std::size_t numberOfKnots, std::vector<std::size_t> knotsToTrack) :
+      knots(numberOfKnots), knotsToTrack(std::move(knotsToTrack)), trackingSlot(numberOfKnots, NotTracked)
   {
+    for (auto knot : this->knotsToTrack) {
+      if (knot >= numberOfKnots)
+        throw std::runtime_error("Tracked knot does not exist");
+      if (trackingSlot[knot] == NotTracked) {
+        trackingSlot[knot] = static_cast<u32>(uniqueKnotPositions.size());
+        uniqueKnotPositions.emplace_back().insert({0, 0});
+      }
+    }
   }
+
   std::vector<Pos> knots;
-  std::size_t knotIndexToTrack;
-  std::vector<Pos> uniqueKnotPosition = {{0, 0}};
+  std::vector<std::size_t> knotsToTrack;
+  // Index into uniqueKnotPositions for every knot
+  std::vector<u32> trackingSlot;
+  std::vector<PositionSet> uniqueKnotPositions;
+
+  const PositionSet& uniquePositionsOf(std::size_t knot) const
+  {
+    return uniqueKnotPositions[trackingSlot[knot]];
+  }
 
   void execute(Movement movement)
   {
@@ -74,46 +195,55 @@ struct Rope
              std::abs(knots[knotIndex - 1].y - knots[knotIndex].y) <= 1;
     };
 
-    auto updateKnots = [this, tailValidPos]() {
+    auto track = [this](std::size_t knotIndex) {
+      if (trackingSlot[knotIndex] != NotTracked) {
+        uniqueKnotPositions[trackingSlot[knotIndex]].insert(knots[knotIndex]);
+      }
+    };
+
+    // Returns true if every knot moved exactly like the head
+    auto updateKnots = [this, tailValidPos, track](Pos step) {
+      track(0);
       for (std::size_t i = 1; i < knots.size(); i++) {
-        if (!tailValidPos(i)) {
-          for (int c{}; c < 2; c++) {
-            auto diff = knots[i - 1][c] - knots[i][c];
-            if (diff != 0) {
-              knots[i][c] += std::signbit(diff) ? -1 : 1;
-            }
-          }
-          if (i == knotIndexToTrack && !ranges::contains(uniqueKnotPosition, knots[knotIndexToTrack])) {
-            uniqueKnotPosition.push_back(knots[knotIndexToTrack]);
+        // Knots behind one that did not move stay where they are as well
+        if (tailValidPos(i))
+          return false;
+
+        Pos before = knots[i];
+        for (int c{}; c < 2; c++) {
+          auto diff = knots[i - 1][c] - knots[i][c];
+          if (diff != 0) {
+            knots[i][c] += std::signbit(diff) ? -1 : 1;
           }
         }
+        track(i);
+        if (knots[i].x - before.x != step.x || knots[i].y - before.y != step.y)
+          step = {0, 0};
+      }
+      return step != Pos{0, 0};
+    };
+
+    // Once the whole rope moved in lockstep the knots keep their offsets to each other, so every further step of the
+    // movement only translates the rope
+    auto fastForward = [this](Pos step, i32 count) {
+      for (std::size_t i = 0; i < knots.size(); i++) {
+        if (trackingSlot[i] != NotTracked)
+          uniqueKnotPositions[trackingSlot[i]].insertRun(knots[i], step, count);
+        knots[i].x += step.x * count;
+        knots[i].y += step.y * count;
       }
     };
 
     using D = Movement::Dir;
+    Pos step{movement.dir == D::Right ? 1 : movement.dir == D::Left ? -1 : 0,
+             movement.dir == D::Up ? 1 : movement.dir == D::Down ? -1 : 0};
     for (i32 c = 0; c < movement.count; c++) {
-      switch (movement.dir) {
-      case D::Right: {
-        knots[0].x++;
-        updateKnots();
-        break;
-      }
-      case D::Left: {
-        knots[0].x--;
-        updateKnots();
+      knots[0].x += step.x;
+      knots[0].y += step.y;
+      if (updateKnots(step)) {
+        fastForward(step, movement.count - c - 1);
         break;
       }
-      case D::Up: {
-        knots[0].y++;
-        updateKnots();
-        break;
-      }
-      case D::Down: {
-        knots[0].y--;
-        updateKnots();
-        break;
-      }
-      }
     }
   }
 };
@@ -124,7 +254,83 @@ u64 countUniqueTailPositions(const std::vector<Movement>& movements, Rope rope)
     rope.execute(move);
   }
 
-  return rope.uniqueKnotPosition.size();
+  return rope.uniquePositionsOf(rope.knotsToTrack[0]).size();
+}
+
+// Simulates the rope once and returns the unique position count of every tracked knot, in the order given to the rope.
+// The first knots of a long rope move exactly like a short rope, so Rope(10, {1, 9}) answers both 2 and 10 knots.
+std::vector<u64> countUniquePositions(const std::vector<Movement>& movements, Rope rope)
+{
+  for (auto move : movements) {
+    rope.execute(move);
+  }
+
+  auto count = [&rope](std::size_t knot) { return static_cast<u64>(rope.uniquePositionsOf(knot).size()); };
+  return rope.knotsToTrack | ranges::views::transform(count) | ranges::to<std::vector<u64>>();
+}
+
+// Runs countUniquePositions for every rope against the same movements, spread over a number of threads. Ropes with
+// many knots take longer, so they are handed out one by one. Results are in the order of ropes.
+std::vector<std::vector<u64>> simulateRopes(const std::vector<Movement>& movements, const std::vector<Rope>& ropes,
+                                            std::size_t threadCount = std::thread::hardware_concurrency())
+{
+  std::vector<std::vector<u64>> counts(ropes.size());
+  parallelForEach(ropes.size(), threadCount,
+                  [&](std::size_t i) { counts[i] = countUniquePositions(movements, ropes[i]); });
+  return counts;
+}
+
+// Rope with a compile time number of knots and their coordinates in separate arrays. Following the previous knot is
+// computed without branches, the only branch per knot is the exit once a knot stays in place. Only the tail is tracked.
+template <std::size_t N>
+struct FixedRope
+{
+  static_assert(N >= 2);
+
+  std::array<i32, N> x{};
+  std::array<i32, N> y{};
+  PositionSet uniqueTailPositions = [] {
+    PositionSet set;
+    set.insert({0, 0});
+    return set;
+  }();
+
+  void execute(Movement movement)
+  {
+    using D = Movement::Dir;
+    const i32 stepX = movement.dir == D::Right ? 1 : movement.dir == D::Left ? -1 : 0;
+    const i32 stepY = movement.dir == D::Up ? 1 : movement.dir == D::Down ? -1 : 0;
+
+    for (i32 c = 0; c < movement.count; c++) {
+      x[0] += stepX;
+      y[0] += stepY;
+
+      std::size_t i = 1;
+      for (; i < N; i++) {
+        i32 diffX = x[i - 1] - x[i];
+        i32 diffY = y[i - 1] - y[i];
+        i32 moved = static_cast<i32>(std::abs(diffX) > 1) | static_cast<i32>(std::abs(diffY) > 1);
+        x[i] += moved * std::clamp(diffX, -1, 1);
+        y[i] += moved * std::clamp(diffY, -1, 1);
+        // Knots behind one that did not move stay where they are as well
+        if (!moved)
+          break;
+      }
+
+      if (i == N)
+        uniqueTailPositions.insert({x[N - 1], y[N - 1]});
+    }
+  }
+};
+
+template <std::size_t N>
+u64 countUniqueTailPositions(const std::vector<Movement>& movements, FixedRope<N> rope)
+{
+  for (auto move : movements) {
+    rope.execute(move);
+  }
+
+  return rope.uniqueTailPositions.size();
 }
 
 #ifndef RUN_TESTS
@@ -133,11 +339,24 @@ u64 countUniqueTailPositions(const std::vector<Movement>& movements, Rope rope)
 auto main() -> int
 {
   auto movements = parseMovements(std::fstream("../../src/day9/input.txt"));
-  fmt::print("Task1 Result: {}\n", countUniqueTailPositions(movements, Rope(2, 1)));
-  fmt::print("Task2 Result: {}\n", countUniqueTailPositions(movements, Rope(10, 9)));
+  auto counts = countUniquePositions(movements, Rope(10, {1, 9}));
+  fmt::print("Task1 Result: {}\n", counts[0]);
+  fmt::print("Task2 Result: {}\n", counts[1]);
 }
 
 #else
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+std::vector<Movement> randomMovements(std::size_t count, i32 maxSteps)
+{
+  std::mt19937 rng(static_cast<u32>(count));
+  std::uniform_int_distribution<int> dir(0, 3);
+  std::uniform_int_distribution<i32> steps(1, maxSteps);
+  std::vector<Movement> movements(count);
+  for (auto& movement : movements)
+    movement = {static_cast<Movement::Dir>(dir(rng)), steps(rng)};
+  return movements;
+}
 
 TEST_CASE("Parsing")
 {
@@ -234,4 +453,125 @@ U 20)";
   }
 }
 
+TEST_CASE("Track several knots in one pass")
+{
+  for (auto& movements : {randomMovements(1000, 10), randomMovements(100, 40)}) {
+    auto counts = countUniquePositions(movements, Rope(10, {9, 1, 0, 4, 1}));
+    REQUIRE(counts == std::vector<u64>{countUniqueTailPositions(movements, Rope(10, 9)),
+                                       countUniqueTailPositions(movements, Rope(2, 1)),
+                                       countUniqueTailPositions(movements, Rope(1, 0)),
+                                       countUniqueTailPositions(movements, Rope(5, 4)), counts[1]});
+  }
+  REQUIRE_THROWS(Rope(2, 2));
+}
+
+TEST_CASE("Fast forward long moves")
+{
+  using D = Movement::Dir;
+  Rope rope(4, {0, 3});
+  rope.execute(Movement{D::Right, 10});
+  REQUIRE(rope.knots == std::vector<Pos>{{10, 0}, {9, 0}, {8, 0}, {7, 0}});
+  REQUIRE(rope.uniquePositionsOf(3).size() == 8);
+  rope.execute(Movement{D::Up, 10});
+  REQUIRE(rope.knots == std::vector<Pos>{{10, 10}, {10, 9}, {10, 8}, {10, 7}});
+  REQUIRE(rope.uniquePositionsOf(0).size() == 21);
+  REQUIRE(rope.uniquePositionsOf(3).contains({10, 4}));
+
+  // Matches a step by step simulation of the same moves split into single steps
+  auto movements = randomMovements(300, 60);
+  std::vector<Movement> singleSteps;
+  for (auto movement : movements)
+    singleSteps.insert(singleSteps.end(), movement.count, Movement{movement.dir, 1});
+  REQUIRE(countUniquePositions(movements, Rope(10, {1, 5, 9})) ==
+          countUniquePositions(singleSteps, Rope(10, {1, 5, 9})));
+}
+
+TEST_CASE("Simulate many ropes")
+{
+  auto movements = randomMovements(500, 30);
+  std::vector<Rope> ropes;
+  for (std::size_t knots = 1; knots < 30; knots++)
+    ropes.emplace_back(knots, std::vector<std::size_t>{knots - 1, knots / 2});
+
+  auto expected = ropes | ranges::views::transform([&](const Rope& rope) {
+                    return countUniquePositions(movements, rope);
+                  }) |
+                  ranges::to<std::vector<std::vector<u64>>>();
+  for (std::size_t threads : {1, 2, 5, 64})
+    REQUIRE(simulateRopes(movements, ropes, threads) == expected);
+  REQUIRE(simulateRopes(movements, {}).empty());
+}
+
+TEST_CASE("Fixed size rope")
+{
+  auto movements = randomMovements(2000, 20);
+  REQUIRE(countUniqueTailPositions(movements, FixedRope<2>{}) == countUniqueTailPositions(movements, Rope(2, 1)));
+  REQUIRE(countUniqueTailPositions(movements, FixedRope<10>{}) == countUniqueTailPositions(movements, Rope(10, 9)));
+  REQUIRE(countUniqueTailPositions(movements, FixedRope<50>{}) == countUniqueTailPositions(movements, Rope(50, 49)));
+}
+
+TEST_CASE("Position set")
+{
+  PositionSet set;
+  std::set<std::pair<i32, i32>> reference;
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<i32> coord(-50, 50);
+  for (int i = 0; i < 10000; i++) {
+    Pos pos{coord(rng), coord(rng)};
+    REQUIRE(set.insert(pos) == reference.emplace(pos.x, pos.y).second);
+  }
+  REQUIRE(set.size() == reference.size());
+  REQUIRE(set.contains({50, -50}) == reference.contains({50, -50}));
+  REQUIRE(!set.contains({51, 0}));
+
+  Pos extreme{std::numeric_limits<i32>::min(), std::numeric_limits<i32>::min()};
+  REQUIRE(!set.contains(extreme));
+  REQUIRE(set.insert(extreme));
+  REQUIRE(!set.insert(extreme));
+  REQUIRE(set.contains(extreme));
+  REQUIRE(set.size() == reference.size() + 1);
+}
+
+TEST_CASE("Long simulation benchmark", "[.][benchmark]")
+{
+  auto movements = randomMovements(200000, 100);
+  BENCHMARK("10 knots, 200k moves")
+  {
+    return countUniqueTailPositions(movements, Rope(10, 9));
+  };
+
+  std::vector<Rope> ropes(8, Rope(10, {1, 9}));
+  BENCHMARK("8 ropes of 10 knots, 200k moves")
+  {
+    return simulateRopes(movements, ropes);
+  };
+
+  BENCHMARK("10 fixed knots, 200k moves")
+  {
+    return countUniqueTailPositions(movements, FixedRope<10>{});
+  };
+
+  auto longMovements = randomMovements(2000, 10000);
+  BENCHMARK("10 knots, 2000 moves of up to 10k steps")
+  {
+    return countUniqueTailPositions(longMovements, Rope(10, 9));
+  };
+}
+
+TEST_CASE("Many knots benchmark", "[.][benchmark]")
+{
+  auto movements = randomMovements(20000, 100);
+  REQUIRE(countUniqueTailPositions(movements, FixedRope<1000>{}) ==
+          countUniqueTailPositions(movements, Rope(1000, 999)));
+
+  BENCHMARK("Rope 1000 knots")
+  {
+    return countUniqueTailPositions(movements, Rope(1000, 999));
+  };
+  BENCHMARK("FixedRope 1000 knots")
+  {
+    return countUniqueTailPositions(movements, FixedRope<1000>{});
+  };
+}
+
 #endif